@@ -0,0 +1,199 @@
+#include "../src/shell.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+#include <new>
+#include <sstream>
+#include <fcntl.h>
+
+static size_t allocations = 0;
+
+void *operator new(size_t size)
+{
+    ++allocations;
+
+    void *pointer = std::malloc(size == 0 ? 1 : size);
+    if (pointer == nullptr)
+        throw std::bad_alloc();
+
+    return (pointer);
+}
+
+void operator delete(void *pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept
+{
+    std::free(pointer);
+}
+
+static const char *filter = nullptr;
+
+template <typename Function>
+static void run(const std::string &name, size_t iterations, size_t bytes_per_iteration, Function function)
+{
+    if (filter != nullptr && name.find(filter) == std::string::npos)
+        return;
+
+    // one warm-up call so that lazily built caches are not billed to the first iteration
+    function();
+
+    size_t allocations_before = allocations;
+    auto start = std::chrono::steady_clock::now();
+
+    for (size_t index = 0; index < iterations; ++index)
+        function();
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double per_iteration = (double)(allocations - allocations_before) / iterations;
+
+    std::printf("%-36s %9zu iter %12.1f ns/op %12.0f op/s %10.1f allocs/op",
+                name.c_str(), iterations, elapsed * 1e9 / iterations, iterations / elapsed, per_iteration);
+
+    if (bytes_per_iteration != 0)
+        std::printf(" %9.1f MB/s", bytes_per_iteration * iterations / elapsed / 1e6);
+
+    std::printf("\n");
+}
+
+static std::string long_line(size_t count)
+{
+    std::string line = "tool --input";
+    for (size_t index = 0; index < count; ++index)
+        line += " /data/shard-" + std::to_string(index) + ".bin";
+
+    return (line);
+}
+
+static void bench_parser(void)
+{
+    const std::vector<std::pair<std::string, std::string>> corpus = {
+        {"simple", "ls -la /usr/local/bin"},
+        {"pipeline", "grep -rn 'pattern with spaces' src/ | sort | uniq -c > /tmp/out.txt"},
+        {"quoted", "echo \"quoted \\\"value\\\" with $HOME\" plain\\ escaped 2>> errors.log"},
+        {"1000 args", long_line(1000)},
+    };
+
+    for (const auto &[name, line] : corpus)
+    {
+        size_t iterations = 2000000 / (line.size() + 16);
+
+        run("parse/" + name, iterations, line.size(), [&]()
+            { parsing::LineParser(line).parse(); });
+    }
+}
+
+static void bench_split(void)
+{
+    std::string path;
+    for (size_t index = 0; index < 64; ++index)
+        path += (index ? ":" : "") + std::string("/opt/toolchain-") + std::to_string(index) + "/bin";
+
+    run("split/64 PATH entries", 100000, path.size(), [&]()
+        { split(path, ":"); });
+}
+
+static std::filesystem::path make_synthetic_path(size_t directories, size_t binaries_per_directory)
+{
+    std::filesystem::path root = std::filesystem::temp_directory_path() / ("shell_bench." + std::to_string(getpid()));
+
+    std::string path;
+    for (size_t directory = 0; directory < directories; ++directory)
+    {
+        std::filesystem::path bin = root / ("bin" + std::to_string(directory));
+        std::filesystem::create_directories(bin);
+
+        for (size_t binary = 0; binary < binaries_per_directory; ++binary)
+        {
+            std::filesystem::path file = bin / ("tool" + std::to_string(directory) + "_" + std::to_string(binary));
+
+            int fd = open(file.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0755);
+            if (fd != -1)
+                close(fd);
+        }
+
+        path += (directory ? ":" : "") + bin.string();
+    }
+
+    setenv("PATH", path.c_str(), 1);
+    return (root);
+}
+
+static void bench_locate(void)
+{
+    const char *previous_path = getenv("PATH");
+    std::string saved_path = previous_path ? previous_path : "";
+
+    std::filesystem::path root = make_synthetic_path(12, 500);
+
+    std::string output;
+    run("locate/hashed hit", 1000000, 0, [&]()
+        { locate("tool11_499", output); });
+
+    run("locate/cold (hash -r)", 20000, 0, [&]()
+        { hashing::clear(); locate("tool11_499", output); });
+
+    run("locate/cached miss", 1000000, 0, [&]()
+        { locate("does-not-exist", output); });
+
+    std::stringstream sink;
+    std::streambuf *stdout_buffer = std::cout.rdbuf(sink.rdbuf());
+
+    run("complete/6000 binaries, 'tool7_4'", 2000, 0, [&]()
+        { std::string line = "tool7_4"; autocompletion::complete(line, false); sink.str(""); });
+
+    run("complete/6000 binaries, unique", 2000, 0, [&]()
+        { std::string line = "tool3_49"; autocompletion::complete(line, false); sink.str(""); });
+
+    std::cout.rdbuf(stdout_buffer);
+
+    std::filesystem::remove_all(root);
+    setenv("PATH", saved_path.c_str(), 1);
+}
+
+static void bench_history(void)
+{
+    std::filesystem::path file = std::filesystem::temp_directory_path() / ("shell_bench_history." + std::to_string(getpid()));
+
+    {
+        std::ofstream stream(file);
+        for (size_t index = 0; index < 500000; ++index)
+            stream << "git commit -m \"change number " << index << "\" --author someone\n";
+    }
+
+    size_t size = std::filesystem::file_size(file);
+
+    // HISTSIZE keeps the in-memory history from growing across iterations
+    setenv("HISTSIZE", "500000", 1);
+
+    run("history/read 500k entries", 10, size, [&]()
+        { history::read(file); });
+
+    run("history/write 500k entries", 10, size, [&]()
+        { history::write(file); });
+
+    unsetenv("HISTSIZE");
+    std::filesystem::remove(file);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1)
+        filter = argv[1];
+
+    builtins::register_defaults();
+
+    bench_parser();
+    bench_split();
+    bench_locate();
+    bench_history();
+
+    return (0);
+}
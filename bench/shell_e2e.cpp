@@ -0,0 +1,260 @@
+// End-to-end throughput of the built shell, driven in batch mode.
+//
+// Usage: shell_e2e [--compare] [--commands N] [--bytes N] [path/to/shell]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+#define MARKER "__shell_e2e_done__"
+
+typedef struct
+{
+    std::string name;
+    std::string path;
+    std::vector<std::string> environment;
+} Shell;
+
+static std::filesystem::path workspace;
+
+static double now(void)
+{
+    return (std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+static std::vector<char *> to_pointers(std::vector<std::string> &strings)
+{
+    std::vector<char *> pointers;
+    for (auto &string : strings)
+        pointers.push_back(string.data());
+
+    pointers.push_back(nullptr);
+    return (pointers);
+}
+
+static std::vector<std::string> environment_of(const Shell &shell)
+{
+    std::vector<std::string> environment;
+    for (char **variable = environ; *variable != nullptr; ++variable)
+        environment.push_back(*variable);
+
+    environment.insert(environment.end(), shell.environment.begin(), shell.environment.end());
+    return (environment);
+}
+
+static pid_t start(const Shell &shell, const std::vector<std::string> &arguments, int fd_in, int fd_out)
+{
+    std::vector<std::string> argv = {shell.path};
+    argv.insert(argv.end(), arguments.begin(), arguments.end());
+
+    std::vector<std::string> environment = environment_of(shell);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fd_in, STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, fd_out, STDOUT_FILENO);
+
+    auto argv_pointers = to_pointers(argv);
+    auto environment_pointers = to_pointers(environment);
+
+    pid_t pid = -1;
+    if (posix_spawn(&pid, shell.path.c_str(), &actions, nullptr, argv_pointers.data(), environment_pointers.data()) != 0)
+        pid = -1;
+
+    posix_spawn_file_actions_destroy(&actions);
+    return (pid);
+}
+
+static double run_script(const Shell &shell, const std::string &script)
+{
+    std::filesystem::path path = workspace / "script.sh";
+    std::ofstream(path) << script;
+
+    int null = open("/dev/null", O_RDWR | O_CLOEXEC);
+
+    double begin = now();
+    pid_t pid = start(shell, {path.string()}, null, null);
+    if (pid != -1)
+        waitpid(pid, nullptr, 0);
+    double elapsed = now() - begin;
+
+    close(null);
+    return (elapsed);
+}
+
+static std::string repeat(const std::vector<std::string> &lines, size_t count)
+{
+    std::string script;
+    for (size_t index = 0; index < count; ++index)
+    {
+        script += lines[index % lines.size()];
+        script += '\n';
+    }
+
+    return (script);
+}
+
+// round trip of one command fed through stdin, measured until the marker echoed after it comes back
+static std::vector<double> latencies(const Shell &shell, const std::string &command, size_t count)
+{
+    int input[2];
+    int output[2];
+    if (pipe2(input, O_CLOEXEC) == -1 || pipe2(output, O_CLOEXEC) == -1)
+        return {};
+
+    pid_t pid = start(shell, {}, input[0], output[1]);
+    close(input[0]);
+    close(output[1]);
+
+    std::vector<double> samples;
+    std::string line = command + "\necho " MARKER "\n";
+    std::string received;
+    char buffer[4096];
+
+    for (size_t index = 0; index < count && pid != -1; ++index)
+    {
+        double begin = now();
+        if (write(input[1], line.data(), line.size()) != (ssize_t)line.size())
+            break;
+
+        received.clear();
+        while (received.find(MARKER) == std::string::npos)
+        {
+            ssize_t size = read(output[0], buffer, sizeof(buffer));
+            if (size <= 0)
+                break;
+
+            received.append(buffer, size);
+        }
+
+        samples.push_back(now() - begin);
+    }
+
+    close(input[1]);
+    close(output[0]);
+
+    if (pid != -1)
+        waitpid(pid, nullptr, 0);
+
+    std::sort(samples.begin(), samples.end());
+    return (samples);
+}
+
+static double percentile(const std::vector<double> &sorted, double fraction)
+{
+    if (sorted.empty())
+        return (0);
+
+    return (sorted[std::min(sorted.size() - 1, (size_t)(fraction * sorted.size()))]);
+}
+
+static void report_commands(const Shell &shell, const std::string &workload, size_t count, double elapsed)
+{
+    std::printf("%-12s %-34s %10.0f commands/s\n", shell.name.c_str(), workload.c_str(), count / elapsed);
+}
+
+static void bench(const Shell &shell, size_t commands, size_t bytes)
+{
+    std::string file = (workspace / "out.txt").string();
+
+    report_commands(shell, "spawn /bin/true", commands, run_script(shell, repeat({"/bin/true"}, commands)));
+
+    report_commands(shell, "builtins", commands, run_script(shell, repeat({"echo hello world", "pwd", "type ls", "echo $?"}, commands)));
+
+    report_commands(shell, "redirects", commands, run_script(shell, repeat({"echo truncate > " + file, "echo append >> " + file, "ls /nonexistent 2> " + file, "echo both > " + file + " 2>> " + file}, commands)));
+
+    // /bin/cat is named so that every shell runs the same program, a bare cat would be this shell's builtin
+    for (size_t stages : {1, 2, 4, 8})
+    {
+        std::string line = "head -c " + std::to_string(bytes) + " /dev/zero";
+        for (size_t index = 0; index < stages; ++index)
+            line += " | /bin/cat";
+        line += " > /dev/null";
+
+        double elapsed = run_script(shell, line + "\n");
+        std::printf("%-12s %-34s %10.0f MB/s\n", shell.name.c_str(), (std::to_string(stages) + "-stage /bin/cat pipeline").c_str(), bytes / elapsed / 1e6);
+    }
+
+    // only this shell knows the option, the others would just fail the set line
+    if (shell.name.starts_with("shell"))
+    {
+        for (const char *size : {"default", "256K", "1M", "4M"})
+        {
+            std::string script = std::string(size) == "default" ? "set +o pipesize\n" : "set -o pipesize=" + std::string(size) + "\n";
+            script += "head -c " + std::to_string(bytes) + " /dev/zero | /bin/cat | /bin/cat > /dev/null\n";
+
+            double elapsed = run_script(shell, script);
+            std::printf("%-12s %-34s %10.0f MB/s\n", shell.name.c_str(), ("2-stage /bin/cat, pipesize " + std::string(size)).c_str(), bytes / elapsed / 1e6);
+        }
+    }
+
+    for (const std::string command : {"/bin/true", "echo hello"})
+    {
+        auto samples = latencies(shell, command, std::min<size_t>(commands, 2000));
+        std::printf("%-12s %-34s %8.1f us p50 %8.1f us p99\n", shell.name.c_str(), ("latency " + command).c_str(), percentile(samples, 0.50) * 1e6, percentile(samples, 0.99) * 1e6);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    bool compare = false;
+    size_t commands = 5000;
+    size_t bytes = 1UL << 30;
+
+    std::string shell_path = (std::filesystem::path(argv[0]).parent_path() / "shell").string();
+
+    for (int index = 1; index < argc; ++index)
+    {
+        std::string argument = argv[index];
+
+        if (argument == "--compare")
+            compare = true;
+        else if (argument == "--commands" && index + 1 < argc)
+            commands = std::strtoul(argv[++index], nullptr, 10);
+        else if (argument == "--bytes" && index + 1 < argc)
+            bytes = std::strtoul(argv[++index], nullptr, 10);
+        else
+            shell_path = argument;
+    }
+
+    workspace = std::filesystem::temp_directory_path() / ("shell_e2e." + std::to_string(getpid()));
+    std::filesystem::create_directories(workspace);
+
+    std::vector<Shell> shells = {
+        {.name = "shell", .path = shell_path, .environment = {}},
+        {.name = "shell/fork", .path = shell_path, .environment = {"SHELL_LAUNCHER=fork"}},
+    };
+
+    if (compare)
+    {
+        for (const char *name : {"dash", "bash"})
+        {
+            for (const char *directory : {"/bin/", "/usr/bin/", "/usr/local/bin/"})
+            {
+                std::string path = std::string(directory) + name;
+                if (access(path.c_str(), X_OK) == 0)
+                {
+                    shells.push_back({.name = name, .path = path, .environment = {}});
+                    break;
+                }
+            }
+        }
+    }
+
+    for (const auto &shell : shells)
+        bench(shell, commands, bytes);
+
+    std::filesystem::remove_all(workspace);
+    return (0);
+}
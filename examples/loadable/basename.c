@@ -0,0 +1,46 @@
+// A sample builtin for `enable -f`: POSIX basename without the fork and exec.
+//
+// Built along with the shell, e.g. `enable -f ./build/basename.so basename`.
+
+#include "loadable.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+int basename_builtin(int argc, char *const *argv, const shell_streams *streams)
+{
+    if (argc < 2 || argc > 3)
+    {
+        dprintf(streams->error, "basename: usage: basename string [suffix]\n");
+        return (2);
+    }
+
+    const char *string = argv[1];
+    size_t length = strlen(string);
+
+    while (length > 1 && string[length - 1] == '/')
+        --length;
+
+    size_t start = length;
+    while (start > 0 && string[start - 1] != '/')
+        --start;
+
+    // only slashes are left, the name is the root itself
+    if (start == length && length != 0)
+        start = length - 1;
+
+    const char *name = string + start;
+    size_t name_length = length - start;
+
+    if (argc == 3)
+    {
+        size_t suffix_length = strlen(argv[2]);
+
+        if (suffix_length < name_length && memcmp(name + name_length - suffix_length, argv[2], suffix_length) == 0)
+            name_length -= suffix_length;
+    }
+
+    dprintf(streams->output, "%.*s\n", (int)name_length, name);
+    return (0);
+}
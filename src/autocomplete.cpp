@@ -5,6 +5,7 @@
 #include <vector>
 #include <functional>
 #include <filesystem>
+#include <algorithm>
 
 namespace autocompletion
 {
@@ -42,34 +43,96 @@ namespace autocompletion
         }
     }
 
-    static void collect_executables(std::set<std::string, string_comparator> &candidates, const std::string &line)
+    typedef struct
     {
-        const char *$path = getenv("PATH");
-        if (!$path)
-            return;
+        std::string path;
+        std::filesystem::file_time_type modified_at;
+        std::vector<std::string> names;
+    } IndexedDirectory;
 
-        std::vector<std::string> paths = split(std::string($path), ":");
+    static std::vector<IndexedDirectory> directories;
+    static std::vector<std::string> index;
+    static std::optional<std::string> indexed_path;
 
-        for (const auto &raw_path : paths)
-        {
-            std::filesystem::path path = raw_path;
+    static std::vector<std::string> scan(const std::filesystem::path &path)
+    {
+        std::vector<std::string> names;
 
-            if (!std::filesystem::is_directory(path))
+        std::error_code error;
+        for (const auto &entry : std::filesystem::directory_iterator(path, error))
+        {
+            constexpr auto executable = std::filesystem::perms::owner_exec | std::filesystem::perms::group_exec | std::filesystem::perms::others_exec;
+            if (!entry.is_regular_file(error) || (entry.status(error).permissions() & executable) == std::filesystem::perms::none)
                 continue;
 
-            for (const auto &entry : std::filesystem::directory_iterator(path))
-            {
-                const std::string &name = entry.path().filename().string();
-                if (name.rfind(line, 0) != 0)
-                    continue;
+            names.push_back(entry.path().filename().string());
+        }
 
-                constexpr auto executable = std::filesystem::perms::owner_exec | std::filesystem::perms::group_exec | std::filesystem::perms::others_exec;
-                if (!entry.is_regular_file() || (entry.status().permissions() & executable) == std::filesystem::perms::none)
-                    continue;
+        return (names);
+    }
 
-                std::string candidate = name.substr(line.length());
-                candidates.insert(candidate);
-            }
+    static bool refresh(IndexedDirectory &directory)
+    {
+        std::error_code error;
+
+        auto modified_at = std::filesystem::last_write_time(directory.path, error);
+        if (error)
+            modified_at = std::filesystem::file_time_type::min();
+
+        if (modified_at == directory.modified_at)
+            return (false);
+
+        directory.modified_at = modified_at;
+        directory.names = error ? std::vector<std::string>() : scan(directory.path);
+
+        return (true);
+    }
+
+    static void update_index(void)
+    {
+        const char *$path = getenv("PATH");
+        std::string path = $path ? $path : "";
+
+        bool changed = false;
+        if (path != indexed_path)
+        {
+            directories.clear();
+
+            for (const auto &raw_path : split(path, ":"))
+                directories.push_back(IndexedDirectory{
+                    .path = raw_path,
+                    .modified_at = std::filesystem::file_time_type::max(),
+                    .names = {}});
+
+            indexed_path = path;
+            changed = true;
+        }
+
+        for (auto &directory : directories)
+            changed |= refresh(directory);
+
+        if (!changed)
+            return;
+
+        index.clear();
+        for (const auto &directory : directories)
+            index.insert(index.end(), directory.names.begin(), directory.names.end());
+
+        std::sort(index.begin(), index.end());
+        index.erase(std::unique(index.begin(), index.end()), index.end());
+    }
+
+    static void collect_executables(std::set<std::string, string_comparator> &candidates, const std::string &line)
+    {
+        update_index();
+
+        for (auto iterator = std::lower_bound(index.begin(), index.end(), line); iterator != index.end(); ++iterator)
+        {
+            const std::string &name = *iterator;
+            if (!name.starts_with(line))
+                break;
+
+            candidates.insert(name.substr(line.length()));
         }
     }
 
@@ -0,0 +1,149 @@
+#include "shell.hpp"
+
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+
+#define BATCH_BUFFER_SIZE (64 * 1024)
+
+namespace batch
+{
+    // a here-document keeps the command open, and the line buffered, until its delimiter has been read
+    static std::optional<int> eval_line(const char *start, const char *end, std::string &line)
+    {
+        if (!line.empty())
+            line.push_back('\n');
+
+        line.append(start, end);
+
+        if (line.empty() || parsing::needs_more_input(line))
+            return (std::nullopt);
+
+        auto shell_exit_code = eval(line);
+        line.clear();
+
+        return (shell_exit_code);
+    }
+
+    static std::optional<int> eval_rest(std::string &line)
+    {
+        if (line.empty())
+            return (std::nullopt);
+
+        dprintf(STDERR_FILENO, "shell: warning: here-document delimited by end-of-file\n");
+
+        auto shell_exit_code = eval(line);
+        line.clear();
+
+        return (shell_exit_code);
+    }
+
+    // commands share the script's stdin, so they must find it where the next command starts and not past the buffer,
+    // a seekable one is moved back before each command, anything else is read a byte at a time like bash does
+    int run(int fd)
+    {
+        std::vector<char> buffer(BATCH_BUFFER_SIZE);
+        size_t start = 0;
+        size_t filled = 0;
+
+        bool shared = fd == STDIN_FILENO;
+        bool seekable = shared && lseek(fd, 0, SEEK_CUR) != -1;
+
+        std::string line;
+        while (true)
+        {
+            const char *begin = buffer.data() + start;
+            const char *newline = static_cast<const char *>(std::memchr(begin, '\n', filled - start));
+
+            if (newline != nullptr)
+            {
+                start = newline - buffer.data() + 1;
+
+                off_t position = seekable ? lseek(fd, -(off_t)(filled - start), SEEK_CUR) : -1;
+
+                auto shell_exit_code = eval_line(begin, newline, line);
+                if (shell_exit_code.has_value())
+                    return (shell_exit_code.value());
+
+                // the buffer is kept unless the command read from stdin, then reading goes on from where it stopped
+                if (position != -1 && lseek(fd, 0, SEEK_CUR) == position)
+                    lseek(fd, filled - start, SEEK_CUR);
+                else if (position != -1)
+                    start = filled;
+
+                continue;
+            }
+
+            std::memmove(buffer.data(), begin, filled - start);
+            filled -= start;
+            start = 0;
+
+            if (filled == buffer.size())
+                buffer.resize(buffer.size() * 2);
+
+            size_t wanted = shared && !seekable ? 1 : buffer.size() - filled;
+
+            ssize_t size = ::read(fd, buffer.data() + filled, wanted);
+            if (size == -1 && errno == EINTR)
+                continue;
+
+            if (size <= 0)
+                break;
+
+            filled += size;
+        }
+
+        if (filled != 0)
+        {
+            auto shell_exit_code = eval_line(buffer.data(), buffer.data() + filled, line);
+            if (shell_exit_code.has_value())
+                return (shell_exit_code.value());
+        }
+
+        auto shell_exit_code = eval_rest(line);
+        if (shell_exit_code.has_value())
+            return (shell_exit_code.value());
+
+        return (variables::status());
+    }
+
+    int run_file(const std::string &path)
+    {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            dprintf(STDERR_FILENO, "shell: %s: %s\n", path.c_str(), strerror(errno));
+            return (127);
+        }
+
+        int exit_code = run(fd);
+        close(fd);
+
+        return (exit_code);
+    }
+
+    int run_string(const std::string &commands)
+    {
+        std::string line;
+
+        size_t start = 0;
+        while (start < commands.size())
+        {
+            size_t end = commands.find('\n', start);
+            if (end == std::string::npos)
+                end = commands.size();
+
+            auto shell_exit_code = eval_line(commands.data() + start, commands.data() + end, line);
+            if (shell_exit_code.has_value())
+                return (shell_exit_code.value());
+
+            start = end + 1;
+        }
+
+        auto shell_exit_code = eval_rest(line);
+        if (shell_exit_code.has_value())
+            return (shell_exit_code.value());
+
+        return (variables::status());
+    }
+}
@@ -0,0 +1,95 @@
+#include "shell.hpp"
+
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+#define DEFAULT_CAPACITY 256
+
+namespace caching
+{
+    typedef struct
+    {
+        std::string line;
+        std::shared_ptr<const std::vector<parsing::Pipeline>> pipelines;
+    } Entry;
+
+    // most recently used first, the index points into the list so that a hit is moved without a copy
+    static std::list<Entry> order;
+    static std::unordered_map<std::string_view, std::list<Entry>::iterator> index;
+    static size_t capacity = DEFAULT_CAPACITY;
+    static size_t hits = 0;
+    static size_t misses = 0;
+    static std::mutex mutex;
+
+    static void evict(void)
+    {
+        while (order.size() > capacity)
+        {
+            index.erase(order.back().line);
+            order.pop_back();
+        }
+    }
+
+    std::shared_ptr<const std::vector<parsing::Pipeline>> find(const std::string &line)
+    {
+        std::lock_guard lock(mutex);
+
+        auto entry = index.find(line);
+        if (entry == index.end())
+        {
+            ++misses;
+            return (nullptr);
+        }
+
+        ++hits;
+        order.splice(order.begin(), order, entry->second);
+
+        return (entry->second->pipelines);
+    }
+
+    void remember(const std::string &line, std::vector<parsing::Pipeline> pipelines)
+    {
+        std::lock_guard lock(mutex);
+
+        if (capacity == 0 || index.contains(line))
+            return;
+
+        order.push_front(Entry{
+            .line = line,
+            .pipelines = std::make_shared<const std::vector<parsing::Pipeline>>(std::move(pipelines))});
+
+        index.emplace(order.front().line, order.begin());
+
+        evict();
+    }
+
+    void resize(size_t size)
+    {
+        std::lock_guard lock(mutex);
+
+        capacity = size;
+        evict();
+    }
+
+    void clear(void)
+    {
+        std::lock_guard lock(mutex);
+
+        index.clear();
+        order.clear();
+        hits = 0;
+        misses = 0;
+    }
+
+    Statistics statistics(void)
+    {
+        std::lock_guard lock(mutex);
+
+        return (Statistics{
+            .hits = hits,
+            .misses = misses,
+            .size = order.size(),
+            .capacity = capacity});
+    }
+}
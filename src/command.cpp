@@ -1,5 +1,8 @@
 #include "shell.hpp"
 
+#include <algorithm>
+#include <csignal>
+#include <thread>
 #include <iostream>
 #include <sstream>
 #include <unistd.h>
@@ -7,9 +10,12 @@
 #include <climits>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 
 bool locate(const std::string &program, std::string &output)
 {
+	tracing::Span span("locate", program);
+
 	if (program.starts_with('/'))
 	{
 		if (access(program.c_str(), F_OK | X_OK) == 0)
@@ -21,71 +27,136 @@ bool locate(const std::string &program, std::string &output)
 		return (false);
 	}
 
-	const char *$path = getenv("PATH");
-	if (!$path)
-		return (false);
+	return (hashing::find(program, output));
+}
 
-	std::vector<std::string> paths = split(std::string($path), ":");
+static int get_open_flags(RedirectMode mode)
+{
+	switch (mode)
+	{
+	case RedirectMode::READ:
+		return (O_RDONLY | O_CLOEXEC);
+	case RedirectMode::READ_WRITE:
+		return (O_CREAT | O_RDWR | O_CLOEXEC);
+	case RedirectMode::APPEND:
+		return (O_CREAT | O_WRONLY | O_APPEND | O_CLOEXEC);
+	case RedirectMode::TRUNCATE:
+	default:
+		return (O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC);
+	}
+}
 
-	for (std::vector<std::string>::iterator iterator = paths.begin(); iterator != paths.end(); ++iterator)
+// small documents fit in a pipe buffer whole, larger ones get a seekable memory file, neither touches the disk
+static int open_document(const std::string &document)
+{
+	if (document.size() <= PIPE_BUF)
 	{
-		std::string path = *iterator + "/" + program;
+		int pipe_fds[2];
+		if (pipe2(pipe_fds, O_CLOEXEC) == -1)
+			return (-1);
 
-		if (access(path.c_str(), F_OK | X_OK) == 0)
+		if (write(pipe_fds[1], document.data(), document.size()) != (ssize_t)document.size())
 		{
-			output = path;
-			return (true);
+			::close(pipe_fds[0]);
+			pipe_fds[0] = -1;
+		}
+
+		::close(pipe_fds[1]);
+		return (pipe_fds[0]);
+	}
+
+	int fd = memfd_create("here-document", MFD_CLOEXEC);
+	if (fd == -1)
+		return (-1);
+
+	for (size_t written = 0; written < document.size();)
+	{
+		ssize_t size = write(fd, document.data() + written, document.size() - written);
+		if (size == -1 && errno == EINTR)
+			continue;
+
+		if (size <= 0)
+		{
+			::close(fd);
+			return (-1);
 		}
+
+		written += size;
 	}
 
-	return (false);
+	lseek(fd, 0, SEEK_SET);
+	return (fd);
 }
 
-RedirectedStreams::RedirectedStreams(const std::vector<Redirect> &redirects)
+static void replace(std::optional<int> &stream, int fd)
 {
-	std::optional<int> output;
-	std::optional<int> error;
+	if (stream.has_value())
+		::close(stream.value());
 
-	for (auto redirect : redirects)
+	stream = fd;
+}
+
+RedirectedStreams::RedirectedStreams(const std::vector<Redirect> &redirects, int default_input, int default_output, int default_error)
+	: _default_input(default_input),
+	  _default_output(default_output),
+	  _default_error(default_error)
+{
+	tracing::Span span("redirect");
+
+	for (const auto &redirect : redirects)
 	{
-		int flags = O_CREAT | O_WRONLY;
-		if (redirect.append)
-			flags |= O_APPEND;
-		else
-			flags |= O_TRUNC;
+		bool document = redirect.mode == RedirectMode::HERE_DOCUMENT || redirect.mode == RedirectMode::HERE_STRING;
 
-		int fd = open(redirect.path.c_str(), flags, 0644);
-		if (fd == -1)
+		int fd;
+		if (redirect.mode == RedirectMode::DUPLICATE)
 		{
-			const char *error = strerror(errno);
-			std::cerr << "shell: " << redirect.path << ": " << error;
-			_valid = false;
-			break;
+			std::optional<unsigned long long> source = parse_unsigned(redirect.path);
+			fd = source.has_value() && source.value() <= INT_MAX ? fcntl(descriptor((int)source.value()), F_DUPFD_CLOEXEC, 0) : -1;
+			if (fd == -1)
+				errno = EBADF;
 		}
+		else if (std::optional<int> named = named_descriptor(redirect.path); named.has_value() && !document)
+			fd = open(reopen_path(descriptor(named.value())).c_str(), get_open_flags(redirect.mode), 0644);
+		else
+			fd = document ? open_document(redirect.document) : open(redirect.path.c_str(), get_open_flags(redirect.mode), 0644);
 
-		if (StandardNamedStream::OUTPUT == redirect.stream_name)
+		if (fd == -1)
 		{
-			if (output.has_value())
-				::close(output.value());
+			const char *message = strerror(errno);
+			std::cerr << "shell: " << (document ? "here-document" : redirect.path) << ": " << message << std::endl;
 
-			output = fd;
+			_valid = false;
+			return;
 		}
-		else if (StandardNamedStream::ERROR == redirect.stream_name)
-		{
-			if (error.has_value())
-				::close(error.value());
 
-			error = fd;
-		}
+		if (StandardNamedStream::INPUT == redirect.stream_name)
+			replace(_input, fd);
+		else if (StandardNamedStream::OUTPUT == redirect.stream_name)
+			replace(_output, fd);
+		else if (StandardNamedStream::ERROR == redirect.stream_name)
+			replace(_error, fd);
 		else
 			::close(fd);
 	}
 
-	_output = output;
-	_error = error;
 	_valid = true;
 }
 
+// what a descriptor of the command refers to so far, with the redirects before this one applied
+int RedirectedStreams::descriptor(int fd) const
+{
+	if (fd == STDIN_FILENO)
+		return (input());
+
+	if (fd == STDOUT_FILENO)
+		return (output());
+
+	if (fd == STDERR_FILENO)
+		return (error());
+
+	return (fd);
+}
+
 RedirectedStreams::~RedirectedStreams()
 {
 	close();
@@ -93,6 +164,12 @@ RedirectedStreams::~RedirectedStreams()
 
 void RedirectedStreams::close()
 {
+	if (_input.has_value())
+	{
+		::close(_input.value());
+		_input.reset();
+	}
+
 	if (_output.has_value())
 	{
 		::close(_output.value());
@@ -110,25 +187,53 @@ namespace builtins
 {
 	registry_map REGISTRY;
 
-	std::optional<int> exit(const std::vector<std::string> &_, const RedirectedStreams &__)
+	// builtins turned off with enable -n, kept aside so that enable can bring them back
+	registry_map DISABLED;
+
+	// pipeline stages read the registry without a lock, so it only changes on the main thread while none of them runs
+	std::atomic<size_t> running_threads = 0;
+	static std::thread::id main_thread;
+
+	// a builtin returns whether the shell should exit, its status is handed over on the side of the thread running it
+	static thread_local int exit_code = 0;
+
+	void set_exit_code(int code)
+	{
+		exit_code = code;
+	}
+
+	int take_exit_code(void)
 	{
-		return (std::optional<int>(EXIT_SUCCESS));
+		int code = exit_code;
+		exit_code = 0;
+
+		return (code);
+	}
+
+	std::optional<int> exit(const std::vector<std::string> &arguments, const RedirectedStreams &__)
+	{
+		if (arguments.size() > 1)
+			return (std::optional<int>(std::atoi(arguments[1].c_str()) & 0xff));
+
+		return (std::optional<int>(variables::status()));
 	}
 
 	std::optional<int> echo(const std::vector<std::string> &arguments, const RedirectedStreams &streams)
 	{
+		BufferedWriter output(streams.output());
+
 		size_t size = arguments.size();
 		size_t last_index = size - 1;
 
 		for (size_t index = 1; index < size; ++index)
 		{
-			dprintf(streams.output(), "%s", arguments[index].c_str());
+			output.write(arguments[index]);
 
 			if (last_index != index)
-				dprintf(streams.output(), " ");
+				output.put(' ');
 		}
 
-		dprintf(streams.output(), "\n");
+		output.put('\n');
 
 		return (std::nullopt);
 	}
@@ -152,6 +257,7 @@ namespace builtins
 		}
 
 		dprintf(streams.error(), "%s: not found\n", program.c_str());
+		set_exit_code(1);
 
 		return (std::nullopt);
 	}
@@ -190,21 +296,32 @@ namespace builtins
 		}
 
 		if (absolute_path.empty())
+		{
+			set_exit_code(1);
 			return (std::nullopt);
+		}
 
 		if (chdir(absolute_path.c_str()) == -1)
+		{
 			dprintf(streams.output(), "cd: %s: %s\n", path.c_str(), strerror(errno));
+			set_exit_code(1);
+		}
 
 		return (std::nullopt);
 	}
 
 	static void _print_history(size_t start, const RedirectedStreams &streams)
 	{
-		size_t size = history::get().size();
+		BufferedWriter output(streams.output());
+
+		size_t base = history::base();
+		size_t size = history::size();
 		for (size_t index = start; index < size; ++index)
 		{
-			const std::string &line = history::get()[index];
-			dprintf(streams.output(), "%5zu %s\n", index + 1, line.c_str());
+			output.number(base + index + 1, 5);
+			output.put(' ');
+			output.write(history::at(index));
+			output.put('\n');
 		}
 	}
 
@@ -228,10 +345,11 @@ namespace builtins
 			if (stream.fail())
 			{
 				dprintf(streams.error(), "history: invalid argument '%s'\n", arguments[1].c_str());
+				set_exit_code(1);
 				return (std::nullopt);
 			}
 
-			start = history::get().size() - start;
+			start = history::size() - std::min(start, history::size());
 			_print_history(start, streams);
 		}
 		else
@@ -240,13 +358,595 @@ namespace builtins
 		return (std::nullopt);
 	}
 
+	std::optional<int> hash(const std::vector<std::string> &arguments, const RedirectedStreams &streams)
+	{
+		const std::string &first = arguments.size() > 1 ? arguments[1] : "";
+
+		if (first == "-r")
+			hashing::clear();
+		else if (first == "-p")
+		{
+			if (arguments.size() < 4)
+			{
+				dprintf(streams.error(), "hash: usage: hash [-r] [-p pathname] [-d] [name ...]\n");
+				set_exit_code(2);
+				return (std::nullopt);
+			}
+
+			hashing::remember(arguments[3], arguments[2]);
+		}
+		else if (first == "-d")
+		{
+			for (size_t index = 2; index < arguments.size(); ++index)
+			{
+				if (!hashing::forget(arguments[index]))
+				{
+					dprintf(streams.error(), "hash: %s: not found\n", arguments[index].c_str());
+					set_exit_code(1);
+				}
+			}
+		}
+		else if (!first.empty())
+		{
+			for (size_t index = 1; index < arguments.size(); ++index)
+			{
+				const std::string &program = arguments[index];
+				if (builtins::REGISTRY.contains(program))
+					continue;
+
+				std::string path;
+				hashing::forget(program);
+				if (!hashing::find(program, path))
+				{
+					dprintf(streams.error(), "hash: %s: not found\n", program.c_str());
+					set_exit_code(1);
+				}
+			}
+		}
+		else
+		{
+			auto entries = hashing::get();
+			if (entries.empty())
+			{
+				dprintf(streams.output(), "hash: hash table empty\n");
+				return (std::nullopt);
+			}
+
+			BufferedWriter output(streams.output());
+
+			output.write("hits\tcommand\n");
+			for (const auto &[_, entry] : entries)
+				output.printf("%4zu\t%s\n", entry.hits, entry.path.c_str());
+		}
+
+		return (std::nullopt);
+	}
+
+	// a byte count with an optional K, M or G suffix, at most what F_SETPIPE_SZ can take
+	static std::optional<size_t> _parse_size(const std::string &text)
+	{
+		size_t digits = 0;
+		while (digits < text.size() && std::isdigit(text[digits]))
+			++digits;
+
+		if (digits == 0 || text.size() - digits > 1)
+			return (std::nullopt);
+
+		std::optional<unsigned long long> size = parse_unsigned(text.substr(0, digits));
+		if (!size.has_value())
+			return (std::nullopt);
+
+		int shift = 0;
+		char suffix = digits < text.size() ? std::toupper(text[digits]) : '\0';
+		if (suffix == 'K')
+			shift = 10;
+		else if (suffix == 'M')
+			shift = 20;
+		else if (suffix == 'G')
+			shift = 30;
+		else if (suffix != '\0')
+			return (std::nullopt);
+
+		if (size.value() > ((unsigned long long)INT_MAX >> shift))
+			return (std::nullopt);
+
+		return (size.value() << shift);
+	}
+
+	std::optional<int> set(const std::vector<std::string> &arguments, const RedirectedStreams &streams)
+	{
+		if (arguments.size() < 3 || (arguments[1] != "-o" && arguments[1] != "+o"))
+		{
+			BufferedWriter output(streams.output());
+
+			output.printf("trace\t%s\n", tracing::active ? "on" : "off");
+
+			if (pipe_size() == 0)
+				output.write("pipesize\tdefault\n");
+			else
+				output.printf("pipesize\t%zu\n", pipe_size());
+
+			return (std::nullopt);
+		}
+
+		bool enable = arguments[1] == "-o";
+
+		for (size_t index = 2; index < arguments.size(); ++index)
+		{
+			const std::string &option = arguments[index];
+
+			size_t equals = option.find('=');
+			std::string name = option.substr(0, equals);
+
+			if (name == "trace")
+			{
+				if (enable)
+					tracing::start();
+				else
+					tracing::stop();
+			}
+			else if (name == "pipesize")
+			{
+				// +o goes back to the kernel's default
+				std::optional<size_t> size = !enable ? std::optional<size_t>(0) : equals != std::string::npos ? _parse_size(option.substr(equals + 1)) : std::nullopt;
+				if (!size.has_value())
+				{
+					dprintf(streams.error(), "set: %s: invalid pipe size\n", option.c_str());
+					set_exit_code(2);
+					continue;
+				}
+
+				set_pipe_size(size.value());
+			}
+			else
+			{
+				dprintf(streams.error(), "set: %s: invalid option name\n", option.c_str());
+				set_exit_code(2);
+			}
+		}
+
+		return (std::nullopt);
+	}
+
+	std::optional<int> cache(const std::vector<std::string> &arguments, const RedirectedStreams &streams)
+	{
+		const std::string &first = arguments.size() > 1 ? arguments[1] : "";
+
+		if (first == "-r")
+			caching::clear();
+		else if (first == "-s")
+		{
+			std::optional<unsigned long long> size = parse_unsigned(arguments.size() > 2 ? arguments[2] : "");
+			if (!size.has_value() || size.value() > SIZE_MAX)
+			{
+				dprintf(streams.error(), "cache: usage: cache [-r] [-s size]\n");
+				set_exit_code(2);
+				return (std::nullopt);
+			}
+
+			caching::resize(size.value());
+		}
+		else
+		{
+			caching::Statistics statistics = caching::statistics();
+
+			BufferedWriter output(streams.output());
+			output.printf("hits\t%zu\nmisses\t%zu\nentries\t%zu\ncapacity\t%zu\n", statistics.hits, statistics.misses, statistics.size, statistics.capacity);
+		}
+
+		return (std::nullopt);
+	}
+
+	std::optional<int> jobs(const std::vector<std::string> &arguments, const RedirectedStreams &streams)
+	{
+		const std::string &first = arguments.size() > 1 ? arguments[1] : "";
+
+		BufferedWriter output(streams.output());
+
+		auto current = jobs::current(0);
+		auto previous = jobs::current(1);
+
+		for (const auto &job : jobs::list())
+		{
+			if (first == "-p")
+			{
+				output.number(job.process_group);
+				output.put('\n');
+				continue;
+			}
+
+			char marker = job.id == current ? '+' : job.id == previous ? '-' : ' ';
+			output.write(jobs::describe(job, marker));
+
+			if (first == "-l")
+			{
+				for (const auto &process : job.processes)
+				{
+					output.put(' ');
+					output.number(process.pid);
+				}
+			}
+
+			if (job.state == jobs::State::RUNNING)
+				output.write(" &");
+
+			output.put('\n');
+		}
+
+		return (std::nullopt);
+	}
+
+	static std::optional<size_t> _resolve_job(const std::string &name, const std::vector<std::string> &arguments, const RedirectedStreams &streams)
+	{
+		const std::string &specification = arguments.size() > 1 ? arguments[1] : "%+";
+
+		std::optional<size_t> id = jobs::resolve(specification);
+		if (!id.has_value())
+		{
+			dprintf(streams.error(), "%s: %s: no such job\n", name.c_str(), arguments.size() > 1 ? specification.c_str() : "current");
+			set_exit_code(1);
+		}
+
+		return (id);
+	}
+
+	std::optional<int> fg(const std::vector<std::string> &arguments, const RedirectedStreams &streams)
+	{
+		std::optional<size_t> id = _resolve_job("fg", arguments, streams);
+		if (!id.has_value())
+			return (std::nullopt);
+
+		set_exit_code(jobs::foreground(id.value()).value_or(1));
+		return (std::nullopt);
+	}
+
+	std::optional<int> bg(const std::vector<std::string> &arguments, const RedirectedStreams &streams)
+	{
+		std::optional<size_t> id = _resolve_job("bg", arguments, streams);
+		if (!id.has_value())
+			return (std::nullopt);
+
+		jobs::background(id.value());
+		return (std::nullopt);
+	}
+
+	std::optional<int> wait(const std::vector<std::string> &arguments, const RedirectedStreams &streams)
+	{
+		if (arguments.size() == 1)
+		{
+			jobs::wait_all();
+			return (std::nullopt);
+		}
+
+		int code = 0;
+		for (size_t index = 1; index < arguments.size(); ++index)
+		{
+			std::optional<size_t> id = jobs::resolve(arguments[index]);
+			if (!id.has_value())
+			{
+				dprintf(streams.error(), "wait: %s: no such job\n", arguments[index].c_str());
+				code = 127;
+				continue;
+			}
+
+			code = jobs::wait(id.value()).value_or(127);
+		}
+
+		set_exit_code(code);
+		return (std::nullopt);
+	}
+
+	static std::optional<int> _parse_signal(std::string name)
+	{
+		if (!name.empty() && std::all_of(name.begin(), name.end(), ::isdigit))
+		{
+			std::optional<unsigned long long> number = parse_unsigned(name);
+			return (number.has_value() && number.value() < NSIG ? std::optional((int)number.value()) : std::nullopt);
+		}
+
+		std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+		if (name.starts_with("SIG"))
+			name.erase(0, 3);
+
+		for (int number = 1; number < NSIG; ++number)
+		{
+			const char *abbreviation = sigabbrev_np(number);
+			if (abbreviation != nullptr && name == abbreviation)
+				return (number);
+		}
+
+		return (std::nullopt);
+	}
+
+	std::optional<int> kill(const std::vector<std::string> &arguments, const RedirectedStreams &streams)
+	{
+		size_t index = 1;
+		std::optional<int> signal = SIGTERM;
+
+		if (arguments.size() > 1 && arguments[1] == "-l")
+		{
+			BufferedWriter output(streams.output());
+
+			for (int number = 1; number < NSIG; ++number)
+			{
+				const char *abbreviation = sigabbrev_np(number);
+				if (abbreviation != nullptr)
+					output.printf("%2d) SIG%s\n", number, abbreviation);
+			}
+
+			return (std::nullopt);
+		}
+
+		if (arguments.size() > 2 && arguments[1] == "-s")
+		{
+			signal = _parse_signal(arguments[2]);
+			index = 3;
+		}
+		else if (arguments.size() > 2 && arguments[1].starts_with('-'))
+		{
+			signal = _parse_signal(arguments[1].substr(1));
+			index = 2;
+		}
+
+		if (!signal.has_value())
+		{
+			dprintf(streams.error(), "kill: %s: invalid signal specification\n", arguments[index - 1].c_str());
+			set_exit_code(1);
+			return (std::nullopt);
+		}
+
+		int code = 0;
+		for (; index < arguments.size(); ++index)
+		{
+			const std::string &target = arguments[index];
+
+			pid_t pid = 0;
+			if (target.starts_with('%'))
+			{
+				std::optional<size_t> id = jobs::resolve(target);
+				if (id.has_value())
+					pid = -jobs::process_group(id.value()).value_or(0);
+			}
+			else if (std::optional<unsigned long long> number = parse_unsigned(target); number.has_value() && number.value() <= INT_MAX)
+				pid = (pid_t)number.value();
+
+			if (pid == 0)
+			{
+				dprintf(streams.error(), "kill: %s: arguments must be process or job IDs\n", target.c_str());
+				code = 1;
+				continue;
+			}
+
+			if (::kill(pid, signal.value()) == -1)
+			{
+				dprintf(streams.error(), "kill: (%s) - %s\n", target.c_str(), strerror(errno));
+				code = 1;
+				continue;
+			}
+
+			// a stopped job would only see the signal once continued
+			bool stopping = signal.value() == SIGSTOP || signal.value() == SIGTSTP || signal.value() == SIGTTIN || signal.value() == SIGTTOU;
+			if (pid < 0 && !stopping && signal.value() != SIGCONT)
+				::kill(pid, SIGCONT);
+		}
+
+		set_exit_code(code);
+		return (std::nullopt);
+	}
+
+	std::optional<int> parallel(const std::vector<std::string> &arguments, const RedirectedStreams &streams)
+	{
+		long slots = sysconf(_SC_NPROCESSORS_ONLN);
+
+		size_t index = 1;
+		for (; index < arguments.size() && arguments[index].starts_with('-'); ++index)
+		{
+			const std::string &option = arguments[index];
+
+			if (option == "--")
+			{
+				++index;
+				break;
+			}
+
+			std::string value;
+			if (option == "-j" && index + 1 < arguments.size())
+				value = arguments[++index];
+			else if (option.starts_with("-j"))
+				value = option.substr(2);
+
+			std::optional<unsigned long long> number = parse_unsigned(value);
+			if (!number.has_value() || number.value() == 0 || number.value() > LONG_MAX)
+			{
+				dprintf(streams.error(), "parallel: usage: parallel [-j slots] [command ...]\n");
+				set_exit_code(2);
+				return (std::nullopt);
+			}
+
+			slots = (long)number.value();
+		}
+
+		// each argument is a whole command line, without any the lines are read from the input
+		std::vector<std::string> lines(arguments.begin() + index, arguments.end());
+		int input = lines.empty() ? streams.input() : -1;
+
+		set_exit_code(parallel::run(std::move(lines), input, std::max(slots, 1L), streams.output(), streams.error()));
+		return (std::nullopt);
+	}
+
+	std::optional<int> true_(const std::vector<std::string> &_, const RedirectedStreams &__)
+	{
+		return (std::nullopt);
+	}
+
+	std::optional<int> false_(const std::vector<std::string> &_, const RedirectedStreams &__)
+	{
+		set_exit_code(1);
+		return (std::nullopt);
+	}
+
+	std::optional<int> printf(const std::vector<std::string> &arguments, const RedirectedStreams &streams)
+	{
+		set_exit_code(utilities::printf(arguments, streams));
+		return (std::nullopt);
+	}
+
+	std::optional<int> test(const std::vector<std::string> &arguments, const RedirectedStreams &streams)
+	{
+		set_exit_code(utilities::test(arguments, streams));
+		return (std::nullopt);
+	}
+
+	std::optional<int> cat(const std::vector<std::string> &arguments, const RedirectedStreams &streams)
+	{
+		set_exit_code(utilities::cat(arguments, streams));
+		return (std::nullopt);
+	}
+
+	// these only read the shell's state, so a pipeline may run them on a thread of the shell instead of a child
+	static const char *const PURE[] = {"echo", "printf", "test", "[", "true", "false", "cat", "pwd", "type"};
+
+	bool is_pure(const std::string &name)
+	{
+		if (loadable::is_loaded(name))
+			return (false);
+
+		return (std::any_of(std::begin(PURE), std::end(PURE), [&name](const char *pure)
+							{ return (name == pure); }));
+	}
+
+	// cat can block on the terminal or a pipe for as long as it likes, at the prompt it gets a process that ^C and ^Z reach
+	bool waits_on_input(const std::string &name)
+	{
+		return (name == "cat" && !loadable::is_loaded(name));
+	}
+
+	bool disable(const std::string &name)
+	{
+		auto node = REGISTRY.extract(name);
+		if (node.empty())
+			return (false);
+
+		DISABLED.insert(std::move(node));
+		return (true);
+	}
+
+	bool restore(const std::string &name)
+	{
+		auto node = DISABLED.extract(name);
+		if (node.empty())
+			return (REGISTRY.contains(name));
+
+		REGISTRY.insert(std::move(node));
+		return (true);
+	}
+
+	static bool _can_change_registry(const RedirectedStreams &streams)
+	{
+		if (std::this_thread::get_id() == main_thread && running_threads.load() == 0)
+			return (true);
+
+		dprintf(streams.error(), "enable: builtins cannot be changed while a pipeline runs\n");
+		set_exit_code(1);
+		return (false);
+	}
+
+	std::optional<int> enable(const std::vector<std::string> &arguments, const RedirectedStreams &streams)
+	{
+		const std::string &first_argument = arguments.size() > 1 ? arguments[1] : "";
+		bool listing = arguments.size() == 1 || (arguments.size() == 2 && first_argument == "-n");
+
+		if (!listing && !_can_change_registry(streams))
+			return (std::nullopt);
+
+		if (first_argument == "-f")
+		{
+			if (arguments.size() < 4)
+			{
+				dprintf(streams.error(), "enable: usage: enable -f filename name ...\n");
+				set_exit_code(2);
+				return (std::nullopt);
+			}
+
+			for (size_t index = 3; index < arguments.size(); ++index)
+			{
+				std::optional<std::string> error = loadable::load(arguments[2], arguments[index]);
+				if (error.has_value())
+				{
+					dprintf(streams.error(), "enable: %s: %s\n", arguments[index].c_str(), error->c_str());
+					set_exit_code(1);
+				}
+			}
+
+			return (std::nullopt);
+		}
+
+		if (first_argument == "-d")
+		{
+			for (size_t index = 2; index < arguments.size(); ++index)
+			{
+				if (!loadable::unload(arguments[index]))
+				{
+					dprintf(streams.error(), "enable: %s: not dynamically loaded\n", arguments[index].c_str());
+					set_exit_code(1);
+				}
+			}
+
+			return (std::nullopt);
+		}
+
+		bool disabling = arguments.size() > 1 && arguments[1] == "-n";
+		size_t first = disabling ? 2 : 1;
+
+		if (first == arguments.size())
+		{
+			BufferedWriter output(streams.output());
+
+			for (const auto &[name, _] : disabling ? DISABLED : REGISTRY)
+				output.printf("enable %s%s\n", disabling ? "-n " : "", name.c_str());
+
+			return (std::nullopt);
+		}
+
+		for (size_t index = first; index < arguments.size(); ++index)
+		{
+			const std::string &name = arguments[index];
+
+			if (!(disabling ? disable(name) : restore(name)))
+			{
+				dprintf(streams.error(), "enable: %s: not a shell builtin\n", name.c_str());
+				set_exit_code(1);
+			}
+		}
+
+		return (std::nullopt);
+	}
+
 	void register_defaults()
 	{
+		main_thread = std::this_thread::get_id();
+
 		REGISTRY.insert(std::make_pair("exit", exit));
 		REGISTRY.insert(std::make_pair("echo", echo));
 		REGISTRY.insert(std::make_pair("type", type));
 		REGISTRY.insert(std::make_pair("pwd", pwd));
 		REGISTRY.insert(std::make_pair("cd", cd));
 		REGISTRY.insert(std::make_pair("history", history));
+		REGISTRY.insert(std::make_pair("hash", hash));
+		REGISTRY.insert(std::make_pair("set", set));
+		REGISTRY.insert(std::make_pair("cache", cache));
+		REGISTRY.insert(std::make_pair("jobs", jobs));
+		REGISTRY.insert(std::make_pair("fg", fg));
+		REGISTRY.insert(std::make_pair("bg", bg));
+		REGISTRY.insert(std::make_pair("wait", wait));
+		REGISTRY.insert(std::make_pair("kill", kill));
+		REGISTRY.insert(std::make_pair("parallel", parallel));
+		REGISTRY.insert(std::make_pair("true", true_));
+		REGISTRY.insert(std::make_pair("false", false_));
+		REGISTRY.insert(std::make_pair("printf", printf));
+		REGISTRY.insert(std::make_pair("test", test));
+		REGISTRY.insert(std::make_pair("[", test));
+		REGISTRY.insert(std::make_pair("cat", cat));
+		REGISTRY.insert(std::make_pair("enable", enable));
 	}
 }
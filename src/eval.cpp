@@ -0,0 +1,115 @@
+#include "shell.hpp"
+
+#include <iostream>
+
+void prompt()
+{
+	std::cout << "$ " << std::flush;
+}
+
+std::optional<int> exec(const parsing::ParsedLine &parsed_line)
+{
+	const std::vector<std::string> &arguments = parsed_line.arguments;
+	std::string program = arguments[0];
+
+	builtins::registry_map::iterator builtin = builtins::REGISTRY.find(program);
+	if (builtin == builtins::REGISTRY.end() || (terminal::is_interactive() && builtins::waits_on_input(program)))
+	{
+		pipeline(std::span(&parsed_line, 1));
+		return (std::nullopt);
+	}
+
+	RedirectedStreams streams(parsed_line.redirects);
+	if (!streams.valid())
+	{
+		variables::set_status(1);
+		return (std::nullopt);
+	}
+
+	tracing::Span span("builtin", program);
+
+	std::optional<int> shell_exit_code = builtin->second(arguments, streams);
+	variables::set_status(builtins::take_exit_code());
+
+	return (shell_exit_code);
+}
+
+static std::optional<int> run(const parsing::Pipeline &pipeline)
+{
+	const std::vector<parsing::ParsedLine> &commands = pipeline.commands;
+
+	if (pipeline.connector == parsing::Connector::BACKGROUND)
+	{
+		::pipeline(commands, nullptr, true);
+		return (std::nullopt);
+	}
+
+	// time consumes its own options, and the parsed line may be shared with the cache
+	if (commands.front().arguments[0] == "time")
+	{
+		std::vector<parsing::ParsedLine> timed = commands;
+		return (timing::time(timed));
+	}
+
+	if (commands.size() == 1)
+		return (exec(commands.front()));
+
+	::pipeline(commands);
+	return (std::nullopt);
+}
+
+// a short-circuited branch is still parsed to find the next one, but nothing of it runs
+static bool short_circuited(parsing::Connector previous)
+{
+	return ((previous == parsing::Connector::AND && variables::status() != 0) || (previous == parsing::Connector::OR && variables::status() == 0));
+}
+
+std::optional<int> eval(std::string &line)
+{
+	tracing::Span span("eval", line);
+
+	parsing::Connector previous = parsing::Connector::SEQUENCE;
+
+	std::shared_ptr<const std::vector<parsing::Pipeline>> cached = caching::find(line);
+	if (cached != nullptr)
+	{
+		for (const auto &pipeline : *cached)
+		{
+			bool skipped = short_circuited(previous);
+			previous = pipeline.connector;
+
+			if (skipped)
+				continue;
+
+			std::optional<int> shell_exit_code = run(pipeline);
+			if (shell_exit_code.has_value())
+				return (shell_exit_code);
+		}
+
+		return (std::nullopt);
+	}
+
+	parsing::LineParser parser(line);
+	std::vector<parsing::Pipeline> pipelines;
+
+	std::optional<parsing::Pipeline> pipeline;
+	while ((pipeline = parser.next_pipeline()))
+	{
+		bool skipped = short_circuited(previous);
+		previous = pipeline->connector;
+
+		pipelines.push_back(std::move(pipeline.value()));
+
+		if (skipped)
+			continue;
+
+		std::optional<int> shell_exit_code = run(pipelines.back());
+		if (shell_exit_code.has_value())
+			return (shell_exit_code);
+	}
+
+	if (parser.cacheable())
+		caching::remember(line, std::move(pipelines));
+
+	return (std::nullopt);
+}
@@ -0,0 +1,122 @@
+#include "shell.hpp"
+
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <mutex>
+#include <cstdlib>
+
+namespace hashing
+{
+    static std::unordered_map<std::string, Entry> entries;
+    static std::unordered_set<std::string> misses;
+    static std::optional<std::string> last_path;
+    static std::recursive_mutex mutex;
+
+    static void invalidate_if_path_changed(void)
+    {
+        const char *$path = getenv("PATH");
+
+        if ($path == nullptr)
+        {
+            if (last_path.has_value())
+                clear();
+
+            last_path.reset();
+            return;
+        }
+
+        if (last_path.has_value() && last_path.value() == $path)
+            return;
+
+        clear();
+        last_path = std::string($path);
+    }
+
+    static bool search(const std::string &program, std::string &output)
+    {
+        if (!last_path.has_value())
+            return (false);
+
+        std::string path;
+        for (const auto &directory : split(last_path.value(), ":"))
+        {
+            path.assign(directory).append("/").append(program);
+
+            if (access(path.c_str(), X_OK) == 0)
+            {
+                output = path;
+                return (true);
+            }
+        }
+
+        return (false);
+    }
+
+    bool find(const std::string &program, std::string &output)
+    {
+        std::lock_guard lock(mutex);
+
+        invalidate_if_path_changed();
+
+        auto entry = entries.find(program);
+        if (entry != entries.end())
+        {
+            entry->second.hits++;
+            output = entry->second.path;
+            return (true);
+        }
+
+        if (misses.contains(program))
+            return (false);
+
+        std::string path;
+        if (!search(program, path))
+        {
+            misses.insert(program);
+            return (false);
+        }
+
+        entries.insert_or_assign(program, Entry{.path = path, .hits = 1});
+        output = path;
+        return (true);
+    }
+
+    void remember(const std::string &program, const std::string &path)
+    {
+        std::lock_guard lock(mutex);
+
+        invalidate_if_path_changed();
+
+        misses.erase(program);
+        entries.insert_or_assign(program, Entry{.path = path, .hits = 0});
+    }
+
+    bool forget(const std::string &program)
+    {
+        std::lock_guard lock(mutex);
+
+        misses.erase(program);
+        return (entries.erase(program) != 0);
+    }
+
+    void clear(void)
+    {
+        std::lock_guard lock(mutex);
+
+        entries.clear();
+        misses.clear();
+    }
+
+    std::vector<std::pair<std::string, Entry>> get(void)
+    {
+        std::lock_guard lock(mutex);
+
+        std::vector<std::pair<std::string, Entry>> sorted(entries.begin(), entries.end());
+
+        std::sort(sorted.begin(), sorted.end(), [](const auto &x, const auto &y)
+                  { return (x.first < y.first); });
+
+        return (sorted);
+    }
+}
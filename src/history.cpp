@@ -1,13 +1,285 @@
 #include "shell.hpp"
 
-#include <fstream>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <unordered_map>
+#include <string_view>
 
 #define HISTFILE_ENVVAR "HISTFILE"
+#define HISTFILESIZE_ENVVAR "HISTFILESIZE"
+#define HISTSIZE_ENVVAR "HISTSIZE"
+#define HISTCONTROL_ENVVAR "HISTCONTROL"
 
 namespace history
 {
-    std::vector<std::string> lines;
-    size_t last_append_index = 0;
+    // entries live back to back in one buffer, evicted ones are reclaimed by compact()
+    namespace storage
+    {
+        typedef struct
+        {
+            size_t offset;
+            uint32_t length;
+        } Span;
+
+        static std::string bytes;
+        static std::vector<Span> spans;
+        static size_t first = 0;
+        static size_t dead_bytes = 0;
+        static std::unordered_map<size_t, uint32_t> digests;
+        static bool digests_built = false;
+
+        static size_t digest(std::string_view line)
+        {
+            return (std::hash<std::string_view>()(line));
+        }
+
+        static size_t size(void)
+        {
+            return (spans.size() - first);
+        }
+
+        static std::string_view at(size_t position)
+        {
+            const Span &span = spans[first + position];
+
+            return (std::string_view(bytes.data() + span.offset, span.length));
+        }
+
+        // only maintained once erasedups has asked for it
+        static bool contains(std::string_view line)
+        {
+            if (!digests_built)
+            {
+                for (size_t position = 0; position < size(); ++position)
+                    digests[digest(at(position))]++;
+
+                digests_built = true;
+            }
+
+            return (digests.contains(digest(line)));
+        }
+
+        static void push(std::string_view line)
+        {
+            spans.push_back(Span{.offset = bytes.size(), .length = static_cast<uint32_t>(line.size())});
+            bytes.append(line);
+
+            if (digests_built)
+                digests[digest(line)]++;
+        }
+
+        static void forget(size_t position)
+        {
+            std::string_view line = at(position);
+
+            if (digests_built)
+            {
+                auto iterator = digests.find(digest(line));
+                if (iterator != digests.end() && --iterator->second == 0)
+                    digests.erase(iterator);
+            }
+
+            dead_bytes += line.size();
+        }
+
+        static bool compact(void)
+        {
+            bool front_heavy = first > 1024 && first * 2 > spans.size();
+            bool bytes_heavy = dead_bytes > 4096 && dead_bytes * 2 > bytes.size();
+            if (!front_heavy && !bytes_heavy)
+                return (false);
+
+            std::string compacted;
+            compacted.reserve(bytes.size() - dead_bytes);
+
+            std::vector<Span> live;
+            live.reserve(size());
+
+            for (size_t index = first; index < spans.size(); ++index)
+            {
+                live.push_back(Span{.offset = compacted.size(), .length = spans[index].length});
+                compacted.append(bytes, spans[index].offset, spans[index].length);
+            }
+
+            bytes.swap(compacted);
+            spans.swap(live);
+            first = 0;
+            dead_bytes = 0;
+
+            return (true);
+        }
+
+        static void pop_front(void)
+        {
+            forget(0);
+            ++first;
+        }
+
+        // every copy of the line goes in one pass, returns how many of them were before position `before`
+        static size_t erase(std::string_view line, size_t before)
+        {
+            size_t erased_before = 0;
+            size_t kept = first;
+
+            for (size_t index = first; index < spans.size(); ++index)
+            {
+                size_t position = index - first;
+                if (at(position) == line)
+                {
+                    forget(position);
+
+                    if (position < before)
+                        ++erased_before;
+
+                    continue;
+                }
+
+                spans[kept++] = spans[index];
+            }
+
+            spans.resize(kept);
+
+            return (erased_before);
+        }
+    }
+
+    static size_t evicted = 0;
+    static size_t last_append_index = 0;
+
+    namespace index
+    {
+        // trigrams are hashed into a fixed table, collisions are weeded out when matching
+        constexpr size_t BUCKET_BITS = 18;
+
+        // postings hold entry ids (evicted + position) so that evicting from the front keeps them valid
+        static std::vector<std::vector<uint32_t>> postings;
+        static size_t indexed_until = 0;
+        static bool built = false;
+
+        static uint32_t bucket(const char *characters)
+        {
+            uint32_t trigram = (uint32_t)(unsigned char)characters[0] << 16 | (uint32_t)(unsigned char)characters[1] << 8 | (uint32_t)(unsigned char)characters[2];
+
+            return ((trigram * 2654435761u) >> (32 - BUCKET_BITS));
+        }
+
+        static void insert(size_t id)
+        {
+            std::string_view line = storage::at(id - evicted);
+            if (line.size() < 3)
+                return;
+
+            for (size_t offset = 0; offset + 3 <= line.size(); ++offset)
+            {
+                std::vector<uint32_t> &posting = postings[bucket(line.data() + offset)];
+
+                // a line is only listed once per bucket, and always after older lines
+                if (posting.empty() || posting.back() != id)
+                    posting.push_back(id);
+            }
+        }
+
+        static void start(void)
+        {
+            if (built)
+                return;
+
+            postings.resize(1 << BUCKET_BITS);
+            indexed_until = evicted;
+            built = true;
+        }
+
+        static void reset(void)
+        {
+            if (!built)
+                return;
+
+            for (auto &posting : postings)
+                posting.clear();
+
+            indexed_until = evicted;
+        }
+
+        static const std::vector<uint32_t> &rarest_posting(const std::string &query)
+        {
+            const std::vector<uint32_t> *rarest = nullptr;
+
+            for (size_t offset = 0; offset + 3 <= query.size(); ++offset)
+            {
+                const std::vector<uint32_t> &posting = postings[bucket(query.data() + offset)];
+
+                if (rarest == nullptr || posting.size() < rarest->size())
+                    rarest = &posting;
+            }
+
+            return (*rarest);
+        }
+    }
+
+    static std::optional<size_t> get_size_limit(void)
+    {
+        const char *value = std::getenv(HISTSIZE_ENVVAR);
+        if (value == nullptr || value[0] == '\0')
+            return (std::nullopt);
+
+        char *end;
+        long limit = std::strtol(value, &end, 10);
+        if (*end != '\0' || limit < 0)
+            return (std::nullopt);
+
+        return (static_cast<size_t>(limit));
+    }
+
+    static bool has_control(std::string_view option)
+    {
+        const char *value = std::getenv(HISTCONTROL_ENVVAR);
+        if (value == nullptr)
+            return (false);
+
+        for (const auto &control : split(value, ":"))
+        {
+            if (control == option || (control == "ignoreboth" && (option == "ignoredups" || option == "ignorespace")))
+                return (true);
+        }
+
+        return (false);
+    }
+
+    static void evict_front(void)
+    {
+        storage::pop_front();
+        ++evicted;
+
+        if (last_append_index != 0)
+            --last_append_index;
+
+        // stale ids pile up in the postings, rebuild them whenever the storage is compacted
+        if (storage::compact())
+            index::reset();
+    }
+
+    // positions shift past an erased entry, so the index is rebuilt, but only once however many copies went
+    static void erase(const std::string &command)
+    {
+        last_append_index -= storage::erase(command, last_append_index);
+
+        storage::compact();
+        index::reset();
+    }
+
+    static void enforce_size_limit(void)
+    {
+        auto limit = get_size_limit();
+        if (!limit.has_value())
+            return;
+
+        while (storage::size() > limit.value())
+            evict_front();
+    }
 
     std::optional<std::string> get_file(void) {
         const char *path = std::getenv(HISTFILE_ENVVAR);
@@ -17,81 +289,287 @@ namespace history
         return (std::string(path));
     }
 
+    static std::optional<size_t> get_file_size_limit(void)
+    {
+        const char *value = std::getenv(HISTFILESIZE_ENVVAR);
+        if (value == nullptr || value[0] == '\0')
+            return (std::nullopt);
+
+        char *end;
+        long limit = std::strtol(value, &end, 10);
+        if (*end != '\0' || limit < 0)
+            return (std::nullopt);
+
+        return (static_cast<size_t>(limit));
+    }
+
+    static bool write_all(int fd, const std::string &buffer)
+    {
+        size_t written = 0;
+        while (written < buffer.size())
+        {
+            ssize_t size = ::write(fd, buffer.data() + written, buffer.size() - written);
+            if (size == -1 && errno == EINTR)
+                continue;
+
+            if (size <= 0)
+                return (false);
+
+            written += size;
+        }
+
+        return (true);
+    }
+
+    static bool write_from(const std::string &path, size_t start, int flags)
+    {
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | flags, 0600);
+        if (fd == -1)
+            return (false);
+
+        size_t size = 0;
+        for (size_t index = start; index < storage::size(); ++index)
+            size += storage::at(index).size() + 1;
+
+        std::string buffer;
+        buffer.reserve(size);
+
+        for (size_t index = start; index < storage::size(); ++index)
+        {
+            buffer += storage::at(index);
+            buffer += '\n';
+        }
+
+        bool success = write_all(fd, buffer);
+        close(fd);
+
+        return (success);
+    }
+
+    static void truncate(const std::string &path, size_t limit)
+    {
+        int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+        if (fd == -1)
+            return;
+
+        struct stat status;
+        if (fstat(fd, &status) == -1 || status.st_size == 0)
+        {
+            close(fd);
+            return;
+        }
+
+        size_t size = status.st_size;
+        char *data = static_cast<char *>(mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+        if (data == MAP_FAILED)
+        {
+            close(fd);
+            return;
+        }
+
+        // walk backwards to find where the last `limit` lines start
+        size_t start = size;
+        size_t kept = 0;
+        for (size_t index = size; index > 0; --index)
+        {
+            if (data[index - 1] != '\n' || index == size)
+                continue;
+
+            if (++kept == limit)
+            {
+                start = index;
+                break;
+            }
+        }
+
+        if (limit == 0)
+            start = size;
+        else if (kept < limit)
+            start = 0;
+
+        if (start != 0)
+        {
+            std::memmove(data, data + start, size - start);
+            msync(data, size - start, MS_SYNC);
+        }
+
+        munmap(data, size);
+
+        if (start != 0)
+            ftruncate(fd, size - start);
+
+        close(fd);
+    }
+
     void initialize()
     {
         auto histfile = get_file();
         if (histfile.has_value())
             read(histfile.value());
+
+        last_append_index = storage::size();
     }
 
     void finalize()
     {
         auto histfile = get_file();
         if (histfile.has_value())
-            write(histfile.value());
+            append(histfile.value());
     }
 
     void add(const std::string &command)
     {
-        lines.push_back(command);
+        if (get_size_limit() == 0)
+            return;
+
+        if (command.starts_with(' ') && has_control("ignorespace"))
+            return;
+
+        if (has_control("ignoredups") && storage::size() != 0 && storage::at(storage::size() - 1) == command)
+            return;
+
+        if (has_control("erasedups") && storage::contains(command))
+            erase(command);
+
+        storage::push(command);
+        enforce_size_limit();
+    }
+
+    size_t size(void)
+    {
+        return (storage::size());
+    }
+
+    std::string_view at(size_t position)
+    {
+        return (storage::at(position));
     }
 
-    const std::vector<std::string> &get()
+    size_t base(void)
     {
-        return lines;
+        return (evicted);
+    }
+
+    bool index_pending(void)
+    {
+        return (index::built && index::indexed_until < evicted + storage::size());
+    }
+
+    void index_some(size_t count)
+    {
+        index::start();
+
+        size_t end = std::min(evicted + storage::size(), index::indexed_until + count);
+        for (; index::indexed_until < end; ++index::indexed_until)
+            index::insert(index::indexed_until);
+    }
+
+    std::optional<size_t> search(const std::string &query, size_t before)
+    {
+        index::start();
+
+        before = std::min(before, storage::size());
+
+        if (query.size() < 3)
+        {
+            for (size_t position = before; position > 0; --position)
+            {
+                if (storage::at(position - 1).find(query) != std::string::npos)
+                    return (position - 1);
+            }
+
+            return (std::nullopt);
+        }
+
+        // entries the index has not reached yet are scanned, newest first
+        size_t indexed_count = index::indexed_until - evicted;
+        for (size_t position = before; position > indexed_count; --position)
+        {
+            if (storage::at(position - 1).find(query) != std::string::npos)
+                return (position - 1);
+        }
+
+        size_t before_id = evicted + std::min(before, indexed_count);
+
+        const std::vector<uint32_t> &candidates = index::rarest_posting(query);
+        auto iterator = std::lower_bound(candidates.begin(), candidates.end(), before_id);
+
+        while (iterator != candidates.begin())
+        {
+            size_t id = *--iterator;
+            if (id < evicted)
+                break;
+
+            if (storage::at(id - evicted).find(query) != std::string::npos)
+                return (id - evicted);
+        }
+
+        return (std::nullopt);
     }
 
     void read(const std::string &path)
     {
-        std::ifstream file;
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            return;
+
+        struct stat status;
+        if (fstat(fd, &status) == -1 || status.st_size == 0)
+        {
+            close(fd);
+            return;
+        }
+
+        size_t size = status.st_size;
+        const char *data = static_cast<const char *>(mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0));
+        close(fd);
 
-        file.open(path);
-        if (!file.is_open())
+        if (data == MAP_FAILED)
             return;
 
-        std::string line;
-        while (std::getline(file, line))
+        madvise(const_cast<char *>(data), size, MADV_SEQUENTIAL);
+
+        const char *end = data + size;
+        for (const char *line = data; line < end;)
         {
-            if (!line.empty() && line[line.length() - 1] == '\n')
-                line.erase(line.length() - 1);
+            const char *newline = static_cast<const char *>(std::memchr(line, '\n', end - line));
+            if (newline == nullptr)
+                newline = end;
+
+            const char *line_end = newline;
+            if (line_end != line && line_end[-1] == '\r')
+                --line_end;
 
-            if (!line.empty() && line[line.length() - 1] == '\r')
-                line.erase(line.length() - 1);
+            if (line_end != line)
+                storage::push(std::string_view(line, line_end - line));
 
-            if (!line.empty())
-                lines.push_back(line);
+            line = newline + 1;
         }
 
-        file.close();
+        munmap(const_cast<char *>(data), size);
+
+        enforce_size_limit();
     }
 
     void write(const std::string &path)
     {
-        std::ofstream file;
-
-        file.open(path);
-        if (!file.is_open())
+        if (!write_from(path, 0, O_TRUNC))
             return;
 
-        for (const auto &line : lines)
-            file << line << std::endl;
-
-        file.close();
+        auto limit = get_file_size_limit();
+        if (limit.has_value())
+            truncate(path, limit.value());
     }
 
     void append(const std::string &path)
     {
-        std::ofstream file;
-
-        file.open(path, std::ios_base::app);
-        if (!file.is_open())
+        if (!write_from(path, last_append_index, O_APPEND))
             return;
 
-        for (auto iterator = lines.begin() + last_append_index; iterator < lines.end(); ++iterator)
-            file << *iterator << std::endl;
-        
-        last_append_index = lines.size();
+        last_append_index = storage::size();
 
-        file.close();
+        auto limit = get_file_size_limit();
+        if (limit.has_value())
+            truncate(path, limit.value());
     }
 }
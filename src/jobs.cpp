@@ -0,0 +1,475 @@
+#include "shell.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+
+namespace jobs
+{
+    static std::vector<Job> table;
+    static std::recursive_mutex mutex;
+    static int signal_fd = -1;
+    static bool subshell = false;
+    static uint64_t clock = 0;
+
+    // builtin stages of a stopped pipeline run on threads of the shell, they are joined once their job is forgotten
+    static std::map<size_t, std::vector<std::thread>> threads;
+
+    static const int SUBSHELL_SIGNALS_TO_RESET[] = {SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU};
+
+    // whatever is still running when the shell exits ends with it
+    static void release(void)
+    {
+        for (auto &[id, workers] : threads)
+        {
+            for (auto &thread : workers)
+                thread.detach();
+        }
+
+        threads.clear();
+    }
+
+    void initialize(void)
+    {
+        std::atexit(release);
+
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, SIGCHLD);
+
+        // SIGCHLD is only ever consumed through the signalfd, the launcher unblocks it again in children
+        sigprocmask(SIG_BLOCK, &set, nullptr);
+
+        signal_fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+    }
+
+    int descriptor(void)
+    {
+        return (signal_fd);
+    }
+
+    static Job *find(size_t id)
+    {
+        auto iterator = std::find_if(table.begin(), table.end(), [id](const Job &job)
+                                     { return (job.id == id); });
+
+        return (iterator == table.end() ? nullptr : &*iterator);
+    }
+
+    static void join(size_t id)
+    {
+        auto iterator = threads.find(id);
+        if (iterator == threads.end())
+            return;
+
+        for (auto &thread : iterator->second)
+            thread.join();
+
+        threads.erase(iterator);
+    }
+
+    static void remove(size_t id)
+    {
+        join(id);
+
+        std::erase_if(table, [id](const Job &job)
+                      { return (job.id == id); });
+    }
+
+    static void record(Job &job, pid_t pid, int wait_status)
+    {
+        if (WIFSTOPPED(wait_status))
+        {
+            job.state = State::STOPPED;
+            job.notified = false;
+            job.touched = ++clock;
+            return;
+        }
+
+        if (WIFCONTINUED(wait_status))
+        {
+            job.state = State::RUNNING;
+            return;
+        }
+
+        for (auto &process : job.processes)
+        {
+            if (process.pid == pid)
+            {
+                process.code = launcher::to_exit_code(wait_status);
+                process.finished = true;
+            }
+        }
+
+        if (std::all_of(job.processes.begin(), job.processes.end(), [](const Process &process)
+                        { return (process.finished); }))
+        {
+            job.state = State::DONE;
+            job.notified = false;
+        }
+    }
+
+    static int exit_code(const Job &job)
+    {
+        return (job.processes.empty() ? 0 : job.processes.back().code);
+    }
+
+    void update(void)
+    {
+        std::lock_guard lock(mutex);
+
+        // foreground children raise SIGCHLD as well, so the queue is drained even without jobs
+        if (signal_fd != -1)
+        {
+            signalfd_siginfo information;
+            while (::read(signal_fd, &information, sizeof(information)) == sizeof(information))
+                ;
+        }
+
+        // only the groups of known jobs, a foreground pipeline reaps its own children
+        for (auto &job : table)
+        {
+            if (job.state == State::DONE)
+                continue;
+
+            int wait_status = 0;
+            pid_t pid;
+            while ((pid = waitpid(-job.process_group, &wait_status, WNOHANG | WUNTRACED | WCONTINUED)) > 0)
+                record(job, pid, wait_status);
+        }
+    }
+
+    std::optional<size_t> current(size_t offset)
+    {
+        std::lock_guard lock(mutex);
+
+        std::vector<const Job *> recent;
+        for (const auto &job : table)
+            recent.push_back(&job);
+
+        std::sort(recent.begin(), recent.end(), [](const Job *x, const Job *y)
+                  { return (x->touched > y->touched); });
+
+        if (offset >= recent.size())
+            return (std::nullopt);
+
+        return (recent[offset]->id);
+    }
+
+    std::string describe(const Job &job, char marker)
+    {
+        std::string state;
+        switch (job.state)
+        {
+        case State::RUNNING:
+            state = "Running";
+            break;
+        case State::STOPPED:
+            state = "Stopped";
+            break;
+        case State::DONE:
+            state = exit_code(job) == 0 ? "Done" : "Exit " + std::to_string(exit_code(job));
+            break;
+        }
+
+        char prefix[32];
+        snprintf(prefix, sizeof(prefix), "[%zu]%c  %-24s", job.id, marker, state.c_str());
+
+        return (prefix + job.command);
+    }
+
+    static char marker_of(size_t id)
+    {
+        if (current(0) == id)
+            return ('+');
+
+        if (current(1) == id)
+            return ('-');
+
+        return (' ');
+    }
+
+    // reported once at the next prompt, finished jobs are forgotten afterwards
+    void notify(void)
+    {
+        std::lock_guard lock(mutex);
+
+        update();
+
+        std::string report;
+        for (auto &job : table)
+        {
+            if (job.notified || job.state == State::RUNNING)
+                continue;
+
+            report += describe(job, marker_of(job.id)) + "\n";
+            job.notified = true;
+        }
+
+        for (const auto &job : table)
+        {
+            if (job.state == State::DONE && job.notified)
+                join(job.id);
+        }
+
+        std::erase_if(table, [](const Job &job)
+                      { return (job.state == State::DONE && job.notified); });
+
+        if (!report.empty())
+            dprintf(STDERR_FILENO, "%s", report.c_str());
+    }
+
+    size_t add(pid_t process_group, const std::string &command, const std::vector<pid_t> &pids, State state)
+    {
+        std::lock_guard lock(mutex);
+
+        size_t id = table.empty() ? 1 : table.back().id + 1;
+
+        Job job = {
+            .id = id,
+            .process_group = process_group,
+            .command = command,
+            .processes = {},
+            .state = state,
+            .notified = state != State::STOPPED,
+            .touched = ++clock,
+        };
+
+        for (pid_t pid : pids)
+            job.processes.push_back(Process{.pid = pid, .code = 0, .finished = false});
+
+        table.push_back(std::move(job));
+        return (id);
+    }
+
+    void adopt(size_t id, std::vector<std::thread> workers)
+    {
+        std::lock_guard lock(mutex);
+
+        threads.emplace(id, std::move(workers));
+    }
+
+    // like a notification, a finished job is listed once and then forgotten
+    std::vector<Job> list(void)
+    {
+        std::lock_guard lock(mutex);
+
+        update();
+
+        std::vector<Job> listed = table;
+        for (const auto &job : table)
+        {
+            if (job.state == State::DONE)
+                join(job.id);
+        }
+
+        std::erase_if(table, [](const Job &job)
+                      { return (job.state == State::DONE); });
+
+        return (listed);
+    }
+
+    std::optional<size_t> resolve(const std::string &specification)
+    {
+        std::lock_guard lock(mutex);
+
+        if (specification.empty())
+            return (std::nullopt);
+
+        // a plain pid names the job it belongs to
+        if (!specification.starts_with('%'))
+        {
+            std::optional<unsigned long long> number = parse_unsigned(specification);
+            if (!number.has_value() || number.value() > INT_MAX)
+                return (std::nullopt);
+
+            pid_t pid = (pid_t)number.value();
+            for (const auto &job : table)
+            {
+                for (const auto &process : job.processes)
+                {
+                    if (process.pid == pid)
+                        return (job.id);
+                }
+            }
+
+            return (std::nullopt);
+        }
+
+        std::string name = specification.substr(1);
+        if (name.empty() || name == "%" || name == "+")
+            return (current(0));
+
+        if (name == "-")
+            return (current(1));
+
+        if (std::all_of(name.begin(), name.end(), ::isdigit))
+        {
+            std::optional<unsigned long long> id = parse_unsigned(name);
+            return (id.has_value() && find(id.value()) != nullptr ? std::optional<size_t>(id.value()) : std::nullopt);
+        }
+
+        std::optional<size_t> match;
+        for (const auto &job : table)
+        {
+            if (!job.command.starts_with(name))
+                continue;
+
+            // an ambiguous prefix names no job
+            if (match.has_value())
+                return (std::nullopt);
+
+            match = job.id;
+        }
+
+        return (match);
+    }
+
+    std::optional<pid_t> process_group(size_t id)
+    {
+        std::lock_guard lock(mutex);
+
+        Job *job = find(id);
+        if (job == nullptr)
+            return (std::nullopt);
+
+        return (job->process_group);
+    }
+
+    static void wait_for(Job &job, bool foreground)
+    {
+        while (job.state != State::DONE)
+        {
+            int wait_status = 0;
+
+            pid_t pid = waitpid(-job.process_group, &wait_status, foreground ? WUNTRACED : 0);
+            if (pid == -1)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                // reaped behind our back, nothing left to wait for
+                for (auto &process : job.processes)
+                    process.finished = true;
+
+                job.state = State::DONE;
+                break;
+            }
+
+            record(job, pid, wait_status);
+
+            if (foreground && job.state == State::STOPPED)
+                break;
+        }
+    }
+
+    std::optional<int> foreground(size_t id)
+    {
+        std::lock_guard lock(mutex);
+
+        update();
+
+        Job *job = find(id);
+        if (job == nullptr)
+            return (std::nullopt);
+
+        dprintf(STDOUT_FILENO, "%s\n", job->command.c_str());
+
+        terminal::give(job->process_group);
+        kill(-job->process_group, SIGCONT);
+
+        job->state = State::RUNNING;
+        job->notified = true;
+        wait_for(*job, true);
+
+        terminal::reclaim();
+
+        if (job->state == State::STOPPED)
+        {
+            dprintf(STDERR_FILENO, "\n%s\n", describe(*job, marker_of(job->id)).c_str());
+            job->notified = true;
+            return (128 + SIGTSTP);
+        }
+
+        int code = exit_code(*job);
+        remove(id);
+
+        return (code);
+    }
+
+    bool background(size_t id)
+    {
+        std::lock_guard lock(mutex);
+
+        Job *job = find(id);
+        if (job == nullptr)
+            return (false);
+
+        kill(-job->process_group, SIGCONT);
+
+        job->state = State::RUNNING;
+        job->touched = ++clock;
+
+        dprintf(STDOUT_FILENO, "[%zu]%c %s &\n", job->id, marker_of(job->id), job->command.c_str());
+        return (true);
+    }
+
+    std::optional<int> wait(size_t id)
+    {
+        std::lock_guard lock(mutex);
+
+        Job *job = find(id);
+        if (job == nullptr)
+            return (std::nullopt);
+
+        wait_for(*job, false);
+
+        int code = exit_code(*job);
+        remove(id);
+
+        return (code);
+    }
+
+    int wait_all(void)
+    {
+        std::lock_guard lock(mutex);
+
+        int code = 0;
+        while (!table.empty())
+        {
+            wait_for(table.front(), false);
+
+            code = exit_code(table.front());
+            join(table.front().id);
+            table.erase(table.begin());
+        }
+
+        return (code);
+    }
+
+    bool in_subshell(void)
+    {
+        return (subshell);
+    }
+
+    // a forked copy of the shell running a background pipeline, it has neither jobs nor a terminal of its own
+    void enter_subshell(void)
+    {
+        subshell = true;
+        table.clear();
+
+        // the threads stayed behind in the parent, only their handles were copied
+        release();
+
+        terminal::detach();
+
+        for (int signal : SUBSHELL_SIGNALS_TO_RESET)
+            ::signal(signal, SIG_DFL);
+    }
+}
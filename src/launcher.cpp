@@ -0,0 +1,157 @@
+#include "shell.hpp"
+
+#include <spawn.h>
+#include <csignal>
+#include <cstring>
+#include <cstdlib>
+#include <sys/wait.h>
+
+#define LAUNCHER_ENVVAR "SHELL_LAUNCHER"
+
+extern char **environ;
+
+namespace launcher
+{
+    Strategy get_strategy(void)
+    {
+        const char *strategy = std::getenv(LAUNCHER_ENVVAR);
+        if (strategy != nullptr && std::strcmp(strategy, "fork") == 0)
+            return (Strategy::FORK);
+
+        return (Strategy::SPAWN);
+    }
+
+    static const int SIGNALS_TO_RESET[] = {SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGPIPE};
+
+    static std::vector<char *> to_argv(const std::vector<std::string> &arguments)
+    {
+        std::vector<char *> argv;
+        argv.reserve(arguments.size() + 1);
+
+        for (const auto &argument : arguments)
+            argv.push_back(const_cast<char *>(argument.c_str()));
+
+        argv.push_back(nullptr);
+        return (argv);
+    }
+
+    static pid_t launch_with_spawn(const std::string &path, char *const *argv, const RedirectedStreams &streams, std::optional<pid_t> process_group)
+    {
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+
+        if (streams.input() != STDIN_FILENO)
+            posix_spawn_file_actions_adddup2(&actions, streams.input(), STDIN_FILENO);
+
+        if (streams.output() != STDOUT_FILENO)
+            posix_spawn_file_actions_adddup2(&actions, streams.output(), STDOUT_FILENO);
+
+        if (streams.error() != STDERR_FILENO)
+            posix_spawn_file_actions_adddup2(&actions, streams.error(), STDERR_FILENO);
+
+        posix_spawnattr_t attributes;
+        posix_spawnattr_init(&attributes);
+
+        sigset_t defaults;
+        sigemptyset(&defaults);
+        for (int signal : SIGNALS_TO_RESET)
+            sigaddset(&defaults, signal);
+
+        sigset_t mask;
+        sigemptyset(&mask);
+
+        short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+        posix_spawnattr_setsigdefault(&attributes, &defaults);
+        posix_spawnattr_setsigmask(&attributes, &mask);
+
+        if (process_group.has_value())
+        {
+            flags |= POSIX_SPAWN_SETPGROUP;
+            posix_spawnattr_setpgroup(&attributes, process_group.value());
+        }
+
+        posix_spawnattr_setflags(&attributes, flags);
+
+        pid_t pid;
+        int error = posix_spawn(&pid, path.c_str(), &actions, &attributes, argv, environ);
+
+        posix_spawnattr_destroy(&attributes);
+        posix_spawn_file_actions_destroy(&actions);
+
+        if (error != 0)
+        {
+            dprintf(STDERR_FILENO, "shell: %s: %s\n", path.c_str(), strerror(error));
+            return (-1);
+        }
+
+        return (pid);
+    }
+
+    static pid_t launch_with_fork(const std::string &path, char *const *argv, const RedirectedStreams &streams, std::optional<pid_t> process_group)
+    {
+        pid_t pid = fork();
+        if (pid == -1)
+        {
+            perror("fork");
+            return (-1);
+        }
+        else if (pid == 0)
+        {
+            if (process_group.has_value())
+                setpgid(0, process_group.value());
+
+            for (int signal : SIGNALS_TO_RESET)
+                ::signal(signal, SIG_DFL);
+
+            sigset_t mask;
+            sigemptyset(&mask);
+            sigprocmask(SIG_SETMASK, &mask, nullptr);
+
+            dup2(streams.input(), STDIN_FILENO);
+            dup2(streams.output(), STDOUT_FILENO);
+            dup2(streams.error(), STDERR_FILENO);
+
+            execv(path.c_str(), argv);
+            perror("execv");
+            _exit(127);
+        }
+
+        // set from both sides so that the group exists before anyone waits on it
+        if (process_group.has_value())
+            setpgid(pid, process_group.value() == 0 ? pid : process_group.value());
+
+        return (pid);
+    }
+
+    pid_t launch(const std::string &path, const std::vector<std::string> &arguments, const RedirectedStreams &streams, std::optional<pid_t> process_group)
+    {
+        std::vector<char *> argv = to_argv(arguments);
+
+        switch (get_strategy())
+        {
+        case Strategy::FORK:
+        {
+            tracing::Span span("fork", path);
+            return (launch_with_fork(path, argv.data(), streams, process_group));
+        }
+
+        case Strategy::SPAWN:
+        default:
+        {
+            tracing::Span span("spawn", path);
+            return (launch_with_spawn(path, argv.data(), streams, process_group));
+        }
+        }
+    }
+
+    int to_exit_code(int wait_status)
+    {
+        if (WIFEXITED(wait_status))
+            return (WEXITSTATUS(wait_status));
+
+        if (WIFSIGNALED(wait_status))
+            return (128 + WTERMSIG(wait_status));
+
+        return (wait_status);
+    }
+}
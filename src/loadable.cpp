@@ -0,0 +1,97 @@
+#include "shell.hpp"
+#include "loadable.h"
+
+#include <dlfcn.h>
+
+namespace loadable
+{
+    typedef struct
+    {
+        void *handle;
+        std::optional<builtins::registry_map::mapped_type> shadowed;
+        bool disabled;
+    } Loaded;
+
+    static std::map<std::string, Loaded> loaded;
+
+    std::optional<std::string> load(const std::string &path, const std::string &name)
+    {
+        void *handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if (handle == nullptr)
+            return (std::string(dlerror()));
+
+        std::string symbol = name + SHELL_BUILTIN_SUFFIX;
+
+        auto function = reinterpret_cast<shell_builtin_function>(dlsym(handle, symbol.c_str()));
+        if (function == nullptr)
+        {
+            std::string message = dlerror();
+            dlclose(handle);
+
+            return (message);
+        }
+
+        // loading a name again replaces the earlier object, but not what it had shadowed
+        std::optional<builtins::registry_map::mapped_type> shadowed;
+        bool disabled = false;
+        if (auto previous = loaded.find(name); previous != loaded.end())
+        {
+            shadowed = std::move(previous->second.shadowed);
+            disabled = previous->second.disabled;
+            builtins::DISABLED.erase(name);
+            dlclose(previous->second.handle);
+            loaded.erase(previous);
+        }
+        else if (auto builtin = builtins::REGISTRY.find(name); builtin != builtins::REGISTRY.end())
+            shadowed = builtin->second;
+        else if (auto node = builtins::DISABLED.extract(name); !node.empty())
+        {
+            // a builtin turned off with enable -n stays off once the loaded one is gone
+            shadowed = std::move(node.mapped());
+            disabled = true;
+        }
+
+        builtins::REGISTRY.insert_or_assign(name, [function](const std::vector<std::string> &arguments, const RedirectedStreams &streams) -> std::optional<int>
+                                            {
+                                                std::vector<char *> argv;
+                                                for (const auto &argument : arguments)
+                                                    argv.push_back(const_cast<char *>(argument.c_str()));
+                                                argv.push_back(nullptr);
+
+                                                shell_streams fds = {.input = streams.input(), .output = streams.output(), .error = streams.error()};
+
+                                                builtins::set_exit_code(function((int)arguments.size(), argv.data(), &fds));
+                                                return (std::nullopt); });
+
+        loaded.insert_or_assign(name, Loaded{.handle = handle, .shadowed = std::move(shadowed), .disabled = disabled});
+        return (std::nullopt);
+    }
+
+    // the builtin a loaded one had taken the name of comes back
+    bool unload(const std::string &name)
+    {
+        auto entry = loaded.find(name);
+        if (entry == loaded.end())
+            return (false);
+
+        // the loaded builtin goes away whether or not it was turned off itself
+        builtins::REGISTRY.erase(name);
+        builtins::DISABLED.erase(name);
+
+        if (entry->second.shadowed.has_value())
+        {
+            builtins::registry_map &origin = entry->second.disabled ? builtins::DISABLED : builtins::REGISTRY;
+            origin.insert_or_assign(name, std::move(entry->second.shadowed.value()));
+        }
+
+        dlclose(entry->second.handle);
+        loaded.erase(entry);
+
+        return (true);
+    }
+
+    bool is_loaded(const std::string &name)
+    {
+        return (loaded.contains(name));
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef SHELL_LOADABLE_H
+#define SHELL_LOADABLE_H
+
+// The interface of builtins loaded at runtime with `enable -f path name`. The
+// shared object exports name_builtin, which runs inside the shell and returns
+// the command's exit status. It is plain C so that it does not depend on the
+// compiler or standard library the shell was built with.
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct
+    {
+        int input;
+        int output;
+        int error;
+    } shell_streams;
+
+    typedef int (*shell_builtin_function)(int argc, char *const *argv, const shell_streams *streams);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define SHELL_BUILTIN_SUFFIX "_builtin"
+
+#endif
@@ -1,100 +1,278 @@
 #include "shell.hpp"
 
 #include <iostream>
-#include <sys/wait.h>
 #include <unistd.h>
 #include <termios.h>
+#include <csignal>
+#include <cerrno>
+#include <string_view>
+#include <cctype>
+#include <poll.h>
 
 #define UP 'A'
 #define DOWN 'B'
+#define ESCAPE '\x1b'
+#define PASTE_START "[200~"
+#define PASTE_END "\x1b[201~"
+#define BRACKETED_PASTE_ON "\x1b[?2004h"
+#define BRACKETED_PASTE_OFF "\x1b[?2004l"
+#define CLEAR_LINE "\r\x1b[K"
+#define CONTINUATION_PROMPT "> "
+#define CTRL_C 0x3
+#define CTRL_G 0x7
+#define CTRL_R 0x12
+#define HISTORY_INDEX_CHUNK 1024
+
+static char input_buffer[4096];
+static size_t input_start = 0;
+static size_t input_end = 0;
+static std::string pending_output;
+
+static void flush_output()
+{
+	size_t written = 0;
+	while (written < pending_output.size())
+	{
+		ssize_t size = write(STDOUT_FILENO, pending_output.data() + written, pending_output.size() - written);
+		if (size == -1 && errno == EINTR)
+			continue;
+
+		if (size <= 0)
+			break;
+
+		written += size;
+	}
+
+	pending_output.clear();
+}
+
+static bool input_ready()
+{
+	struct pollfd descriptor = {.fd = STDIN_FILENO, .events = POLLIN, .revents = 0};
+
+	return (poll(&descriptor, 1, 0) != 0);
+}
+
+static bool fill_input()
+{
+	flush_output();
+
+	// the search index is built while the user is not typing
+	while (history::index_pending() && !input_ready())
+		history::index_some(HISTORY_INDEX_CHUNK);
+
+	// children that finish while the user types are reaped right away, and reported at the next prompt
+	struct pollfd descriptors[2] = {
+		{.fd = STDIN_FILENO, .events = POLLIN, .revents = 0},
+		{.fd = jobs::descriptor(), .events = POLLIN, .revents = 0},
+	};
+
+	while (poll(descriptors, 2, -1) != -1 || errno == EINTR)
+	{
+		if (descriptors[0].revents != 0)
+			break;
+
+		if (descriptors[1].revents != 0)
+			jobs::update();
+	}
+
+	ssize_t size;
+	do
+		size = ::read(STDIN_FILENO, input_buffer, sizeof(input_buffer));
+	while (size == -1 && errno == EINTR);
+
+	if (size <= 0)
+		return (false);
+
+	input_start = 0;
+	input_end = size;
+	return (true);
+}
+
+static int next_input()
+{
+	if (input_start == input_end && !fill_input())
+		return (EOF);
+
+	return (static_cast<unsigned char>(input_buffer[input_start++]));
+}
 
-void prompt()
+// the rest of ESC [ 2 is only a paste when it spells out 200~, anything else (Insert, F9 to F12, ...) is dropped up to its final byte
+static bool is_paste_start()
 {
-	std::cout << "$ " << std::flush;
+	int input = EOF;
+
+	for (const char *expected = PASTE_START + 2; *expected != '\0'; ++expected)
+	{
+		input = next_input();
+		if (input != *expected)
+		{
+			while (input != EOF && (input < 0x40 || input > 0x7e))
+				input = next_input();
+
+			return (false);
+		}
+	}
+
+	return (true);
 }
 
 void bell()
 {
-	std::cout << '\a' << std::flush;
+	pending_output += '\a';
 }
 
 void change_line(std::string &line, const std::string &new_line)
 {
 	size_t length = line.length();
 
-	std::string backspaces(length, '\b');
-	std::string spaces(length, ' ');
-
-	std::cout << backspaces << spaces << backspaces << std::flush;
-
-	std::cout << new_line << std::flush;
+	pending_output.append(length, '\b');
+	pending_output.append(length, ' ');
+	pending_output.append(length, '\b');
+	pending_output += new_line;
 
 	line = new_line;
 }
 
-std::optional<int> exec(const parsing::ParsedLine &parsed_line)
+// a paste of several lines runs them one by one like typed ones, what is left waits here for the next prompt
+static std::string pasted_rest;
+
+// moves the pasted text up to the next newline onto the line, returns whether that ended the line
+static bool take_pasted(std::string &line)
 {
-	RedirectedStreams streams(parsed_line.redirects);
-	if (!streams.valid())
-		return (std::nullopt);
+	size_t newline = pasted_rest.find('\n');
+	std::string_view part(pasted_rest.data(), newline == std::string::npos ? pasted_rest.size() : newline);
 
-	const std::vector<std::string> &arguments = parsed_line.arguments;
-	std::string program = arguments[0];
+	line += part;
+	pending_output += part;
 
-	builtins::registry_map::iterator builtin = builtins::REGISTRY.find(program);
-	if (builtin != builtins::REGISTRY.end())
-		return (builtin->second(arguments, streams));
+	pasted_rest.erase(0, newline == std::string::npos ? std::string::npos : newline + 1);
+	return (newline != std::string::npos);
+}
 
-	std::string path;
-	if (!locate(program, path))
+static bool paste(std::string &line)
+{
+	constexpr std::string_view end_marker = PASTE_END;
+
+	std::string pasted;
+	while (true)
 	{
-		std::cout << program << ": command not found" << std::endl;
-		return (std::nullopt);
+		size_t searched_from = pasted.size() > end_marker.size() ? pasted.size() - end_marker.size() : 0;
+		pasted.append(input_buffer + input_start, input_end - input_start);
+
+		size_t end = pasted.find(end_marker, searched_from);
+		if (end != std::string::npos)
+		{
+			// whatever followed the marker was typed after the paste
+			input_start = input_end - (pasted.size() - end - end_marker.size());
+			pasted.resize(end);
+			break;
+		}
+
+		input_start = input_end;
+		if (!fill_input())
+			break;
 	}
 
-	pid_t pid = fork();
-	if (pid == -1)
+	// terminals send a pasted line break as \r, tabs stay as they are instead of completing
+	for (size_t index = 0; index < pasted.size(); ++index)
 	{
-		perror("fork");
-		return (std::nullopt);
+		if (pasted[index] != '\r')
+			continue;
+
+		if (index + 1 < pasted.size() && pasted[index + 1] == '\n')
+			pasted.erase(index, 1);
+		else
+			pasted[index] = '\n';
 	}
-	else if (pid == 0)
-	{
-		size_t size = arguments.size();
 
-		char *argv[size + 1];
-		argv[size] = NULL;
+	pasted_rest = std::move(pasted);
+	return (take_pasted(line));
+}
+
+enum class SearchResult
+{
+	RUN,
+	EDIT,
+	CANCEL,
+};
+
+static void render_search(const std::string &query, const std::string &match, bool failed)
+{
+	pending_output += CLEAR_LINE;
+	pending_output += failed ? "(failed reverse-i-search)`" : "(reverse-i-search)`";
+	pending_output += query;
+	pending_output += "': ";
+	pending_output += match;
+}
+
+static SearchResult reverse_search(std::string &line, size_t &history_position)
+{
+	std::string query;
+	std::string match = line;
+	size_t position = history::size();
+	bool failed = false;
+
+	render_search(query, match, failed);
 
-		for (size_t index = 0; index < size; ++index)
-			argv[index] = const_cast<char *>(arguments[index].c_str());
+	while (true)
+	{
+		int input = next_input();
+		if (input == EOF || input == CTRL_G)
+		{
+			pending_output += CLEAR_LINE "$ ";
+			pending_output += line;
+			return (SearchResult::CANCEL);
+		}
 
-		dup2(streams.output(), STDOUT_FILENO);
-		dup2(streams.error(), STDERR_FILENO);
+		char character = input;
+		bool accepted = character == '\n' || character == ESCAPE || character == '\t';
+		if (accepted)
+		{
+			line = match;
+			history_position = failed ? history::size() : position;
 
-		streams.close();
+			pending_output += CLEAR_LINE "$ ";
+			pending_output += line;
 
-		execvp(path.c_str(), argv);
-		perror("execvp");
-		exit(1);
-	}
-	else
-		waitpid(pid, NULL, 0);
+			// an escape or tab ends the search and is handled by the editor as usual
+			if (character != '\n')
+				--input_start;
 
-	return (std::nullopt);
-}
+			return (character == '\n' ? SearchResult::RUN : SearchResult::EDIT);
+		}
 
-std::optional<int> eval(std::string &line)
-{
-	history::add(line);
+		// CTRL_R keeps looking from the current match towards older entries
+		size_t before = position;
+		if (character == 0x7f)
+		{
+			if (!query.empty())
+				query.pop_back();
 
-	auto commands = parsing::LineParser(line).parse();
+			before = history::size();
+		}
+		else if (!std::iscntrl(static_cast<unsigned char>(character)))
+		{
+			query.push_back(character);
 
-	if (commands.size() == 1)
-		return (exec(commands.front()));
-	else
-		pipeline(commands);
+			// the current match may still contain the longer query
+			before = std::min(position + 1, history::size());
+		}
+		else if (character != CTRL_R)
+			continue;
+
+		auto found = query.empty() ? std::nullopt : history::search(query, before);
+		if (found.has_value())
+		{
+			position = found.value();
+			match = history::at(position);
+			failed = false;
+		}
+		else
+			failed = !query.empty();
 
-	return (std::nullopt);
+		render_search(query, match, failed);
+	}
 }
 
 struct termios_prompt
@@ -106,14 +284,19 @@ struct termios_prompt
 		tcgetattr(STDIN_FILENO, &previous);
 
 		struct termios new_ = previous;
-		new_.c_lflag &= ~(ECHO | ICANON);
+		new_.c_lflag &= ~(ECHO | ICANON | ISIG);
 		new_.c_cc[VMIN] = 1;
 		new_.c_cc[VTIME] = 0;
 		tcsetattr(STDIN_FILENO, TCSANOW, &new_);
+
+		pending_output += BRACKETED_PASTE_ON;
 	}
 
 	~termios_prompt()
 	{
+		pending_output += BRACKETED_PASTE_OFF;
+		flush_output();
+
 		tcsetattr(STDIN_FILENO, TCSANOW, &previous);
 	}
 };
@@ -125,34 +308,57 @@ enum class ReadResult
 	CONTENT,
 };
 
-ReadResult read(std::string &line)
+ReadResult read(std::string &line, bool continuation = false)
 {
 	line.clear();
 
-	prompt();
+	if (!continuation)
+		jobs::notify();
+
+	if (continuation)
+		std::cout << CONTINUATION_PROMPT << std::flush;
+	else
+		prompt();
 
 	termios_prompt _;
 
-	size_t history_length = history::get().size();
+	size_t history_length = history::size();
 	size_t history_position = history_length;
 
+	if (!pasted_rest.empty() && take_pasted(line))
+	{
+		pending_output += '\n';
+		return (line.empty() ? ReadResult::EMPTY : ReadResult::CONTENT);
+	}
+
 	bool bell_rang = false;
 	while (true)
 	{
-		char character = getchar();
+		int input = next_input();
+		if (input == EOF)
+			return (ReadResult::QUIT);
 
+		char character = input;
 		if (character == 0x4)
 		{
 			if (line.empty())
 				return (ReadResult::QUIT);
 		}
+		else if (character == CTRL_C)
+		{
+			pending_output += "^C\n";
+			line.clear();
+			return (ReadResult::EMPTY);
+		}
 		else if (character == '\n')
 		{
-			std::cout << std::endl;
+			pending_output += '\n';
 			return (line.empty() ? ReadResult::EMPTY : ReadResult::CONTENT);
 		}
 		else if (character == '\t')
 		{
+			flush_output();
+
 			autocompletion::Result result = autocompletion::complete(line, bell_rang);
 
 			switch (result)
@@ -172,15 +378,24 @@ ReadResult read(std::string &line)
 				break;
 			}
 		}
-		else if (character == 0x1b)
+		else if (character == CTRL_R)
 		{
-			getchar(); // '['
+			SearchResult result = reverse_search(line, history_position);
+			if (result == SearchResult::RUN)
+			{
+				pending_output += '\n';
+				return (line.empty() ? ReadResult::EMPTY : ReadResult::CONTENT);
+			}
+		}
+		else if (character == ESCAPE)
+		{
+			next_input(); // '['
 
-			char direction = getchar();
+			int direction = next_input();
 			if (direction == UP && history_position != 0)
 			{
 				history_position--;
-				change_line(line, history::get()[history_position]);
+				change_line(line, std::string(history::at(history_position)));
 			}
 			else if (direction == DOWN && history_position < history_length)
 			{
@@ -189,7 +404,12 @@ ReadResult read(std::string &line)
 				if (history_position == history_length)
 					change_line(line, "");
 				else
-					change_line(line, history::get()[history_position]);
+					change_line(line, std::string(history::at(history_position)));
+			}
+			else if (direction == PASTE_START[1] && is_paste_start() && paste(line))
+			{
+				pending_output += '\n';
+				return (line.empty() ? ReadResult::EMPTY : ReadResult::CONTENT);
 			}
 		}
 		else if (character == 0x7f)
@@ -197,12 +417,12 @@ ReadResult read(std::string &line)
 			if (line.empty())
 				continue;
 
-			std::cout << "\b \b" << std::flush;
+			pending_output += "\b \b";
 			line.pop_back();
 		}
 		else
 		{
-			std::cout << character << std::flush;
+			pending_output += character;
 			line.push_back(character);
 		}
 	}
@@ -211,6 +431,7 @@ ReadResult read(std::string &line)
 int loop()
 {
 	std::string input;
+	std::string continuation;
 	while (true)
 	{
 		switch (read(input))
@@ -220,6 +441,18 @@ int loop()
 		case ReadResult::EMPTY:
 			continue;
 		case ReadResult::CONTENT:
+			history::add(input);
+
+			// the lines of a here-document are its body, not commands of their own
+			while (parsing::needs_more_input(input))
+			{
+				if (read(continuation, true) == ReadResult::QUIT)
+					break;
+
+				input.push_back('\n');
+				input.append(continuation);
+			}
+
 			auto shell_exit_code = eval(input);
 			if (shell_exit_code.has_value())
 				return (shell_exit_code.value());
@@ -227,13 +460,35 @@ int loop()
 	}
 }
 
-int main()
+int main(int argc, char **argv)
 {
 	std::cout << std::unitbuf;
 	std::cerr << std::unitbuf;
 
-	history::initialize();
+	// builtins in a pipeline write from the shell process, a closed reader must not kill it
+	signal(SIGPIPE, SIG_IGN);
+
 	builtins::register_defaults();
+	tracing::initialize();
+	jobs::initialize();
+
+	if (argc > 1 && std::string(argv[1]) == "-c")
+	{
+		if (argc < 3)
+		{
+			std::cerr << "shell: -c: option requires an argument" << std::endl;
+			return (2);
+		}
+
+		return (batch::run_string(argv[2]));
+	}
+	else if (argc > 1)
+		return (batch::run_file(argv[1]));
+	else if (!isatty(STDIN_FILENO))
+		return (batch::run(STDIN_FILENO));
+
+	terminal::initialize();
+	history::initialize();
 
 	int exit_code = loop();
 
@@ -0,0 +1,521 @@
+#include "shell.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// as in GNU parallel, the status counts failed jobs and saturates instead of wrapping around
+#define MAX_FAILURES 101
+
+#define READ_SIZE 4096
+
+#define SELF_PATH "/proc/self/exe"
+
+namespace parallel
+{
+    typedef struct
+    {
+        std::deque<std::string> lines;
+        std::string partial;
+        int fd;
+        bool exhausted;
+    } Source;
+
+    // written by a builtin's thread, done is only set once the code is in place and its descriptors are closed
+    typedef struct
+    {
+        int code;
+        std::atomic<bool> done;
+    } Outcome;
+
+    typedef struct
+    {
+        std::thread thread;
+        size_t index;
+        std::shared_ptr<Outcome> outcome;
+    } Worker;
+
+    typedef struct
+    {
+        std::vector<pid_t> pids;
+        std::vector<int> codes;
+        std::vector<Worker> workers;
+        pid_t process_group;
+        int output;
+        int error;
+    } Job;
+
+    // lines are taken as they arrive, so that a slow producer does not hold back the first jobs
+    static void fill(Source &source)
+    {
+        char buffer[READ_SIZE];
+
+        ssize_t size = ::read(source.fd, buffer, sizeof(buffer));
+        if (size == -1 && errno == EINTR)
+            return;
+
+        if (size <= 0)
+        {
+            if (!source.partial.empty())
+                source.lines.push_back(std::move(source.partial));
+
+            source.partial.clear();
+            source.exhausted = true;
+            return;
+        }
+
+        source.partial.append(buffer, size);
+
+        size_t start = 0;
+        size_t newline;
+        while ((newline = source.partial.find('\n', start)) != std::string::npos)
+        {
+            source.lines.emplace_back(source.partial, start, newline - start);
+            start = newline + 1;
+        }
+
+        source.partial.erase(0, start);
+    }
+
+    // lists, background jobs, time and builtins that change the shell's state need a shell of their own, parallel may be
+    // running on a builtin thread where forking is unsafe, so a fresh shell is spawned instead of a copy of this one
+    static void run_in_subshell(const std::string &line, int input, Job &job)
+    {
+        RedirectedStreams streams({}, input, job.output, job.error);
+
+        pid_t pid = launcher::launch(SELF_PATH, {SELF_PATH, "-c", line}, streams, 0);
+        if (pid == -1)
+        {
+            job.codes = {1};
+            return;
+        }
+
+        job.pids = {pid};
+        job.codes = {0};
+        job.process_group = pid;
+    }
+
+    static bool needs_subshell(const std::vector<parsing::Pipeline> &pipelines)
+    {
+        if (pipelines.size() != 1 || pipelines.front().connector == parsing::Connector::BACKGROUND)
+            return (true);
+
+        const std::vector<parsing::ParsedLine> &commands = pipelines.front().commands;
+        if (commands.front().arguments[0] == "time")
+            return (true);
+
+        return (std::any_of(commands.begin(), commands.end(), [](const parsing::ParsedLine &command)
+                            { return (builtins::REGISTRY.contains(command.arguments[0]) && !builtins::is_pure(command.arguments[0])); }));
+    }
+
+    // a pure builtin runs on a thread writing straight into the job's capture, the eventfd wakes the scheduler once it is done
+    static void run_builtin(const builtins::registry_map::iterator &builtin, const parsing::ParsedLine &command, int fd_in, int fd_out, int input, Job &job, int wake)
+    {
+        std::shared_ptr<Outcome> outcome = std::make_shared<Outcome>();
+        outcome->code = 1;
+
+        ++builtins::running_threads;
+
+        std::thread thread([builtin, command, fd_in, fd_out, input, output = job.output, error = job.error, outcome, wake]()
+                           {
+                               {
+                                   RedirectedStreams streams(command.redirects, fd_in, fd_out, error);
+
+                                   // an exit only ends the job, not the shell running it
+                                   if (streams.valid())
+                                       outcome->code = builtin->second(command.arguments, streams).value_or(builtins::take_exit_code());
+                               }
+
+                               if (fd_in != input)
+                                   close(fd_in);
+
+                               if (fd_out != output)
+                                   close(fd_out);
+
+                               --builtins::running_threads;
+                               outcome->done = true;
+                               eventfd_write(wake, 1); });
+
+        job.pids.push_back(0);
+        job.codes.push_back(1);
+        job.workers.push_back(Worker{.thread = std::move(thread), .index = job.codes.size() - 1, .outcome = std::move(outcome)});
+    }
+
+    static void start(const std::string &line, int input, Job &job, int wake)
+    {
+        parsing::LineParser parser(line);
+        std::vector<parsing::Pipeline> pipelines = parser.parse();
+
+        if (pipelines.empty())
+        {
+            job.codes = {0};
+            return;
+        }
+
+        if (needs_subshell(pipelines))
+        {
+            run_in_subshell(line, input, job);
+            return;
+        }
+
+        const std::vector<parsing::ParsedLine> &commands = pipelines.front().commands;
+
+        int fd_in = input;
+
+        for (size_t index = 0; index < commands.size(); ++index)
+        {
+            const parsing::ParsedLine &command = commands[index];
+            bool last = index + 1 == commands.size();
+
+            int pipe_fds[2] = {-1, job.output};
+            if (!last && open_pipe(pipe_fds) == -1)
+            {
+                perror("pipe");
+                break;
+            }
+
+            // the thread closes the stage's pipe ends itself
+            builtins::registry_map::iterator builtin = builtins::REGISTRY.find(command.arguments[0]);
+            if (builtin != builtins::REGISTRY.end())
+            {
+                run_builtin(builtin, command, fd_in, pipe_fds[1], input, job, wake);
+                fd_in = pipe_fds[0];
+                continue;
+            }
+
+            {
+                RedirectedStreams streams(command.redirects, fd_in, pipe_fds[1], job.error);
+
+                pid_t pid = -1;
+                int code = 1;
+
+                std::string path;
+                if (streams.valid() && !locate(command.arguments[0], path))
+                {
+                    dprintf(job.error, "%s: command not found\n", command.arguments[0].c_str());
+                    code = 127;
+                }
+                else if (streams.valid())
+                    pid = launcher::launch(path, command.arguments, streams, job.process_group);
+
+                // every job is a group of its own, so that ^C and kill reach all of its stages
+                if (pid > 0 && job.process_group == 0)
+                    job.process_group = pid;
+
+                job.pids.push_back(pid > 0 ? pid : 0);
+                job.codes.push_back(pid > 0 ? 0 : code);
+            }
+
+            if (fd_in != input)
+                close(fd_in);
+
+            if (!last)
+                close(pipe_fds[1]);
+
+            fd_in = pipe_fds[0];
+        }
+    }
+
+    // returns whether every stage of the job has been collected, a collected pid is zeroed out and a finished thread joined
+    static bool collect(Job &job)
+    {
+        bool done = true;
+
+        for (auto &worker : job.workers)
+        {
+            if (!worker.thread.joinable())
+                continue;
+
+            if (!worker.outcome->done)
+            {
+                done = false;
+                continue;
+            }
+
+            worker.thread.join();
+            job.codes[worker.index] = worker.outcome->code;
+        }
+
+        for (size_t index = 0; index < job.pids.size(); ++index)
+        {
+            if (job.pids[index] == 0)
+                continue;
+
+            int wait_status = 0;
+            pid_t pid = waitpid(job.pids[index], &wait_status, WNOHANG);
+
+            if (pid == job.pids[index])
+            {
+                job.codes[index] = launcher::to_exit_code(wait_status);
+                job.pids[index] = 0;
+            }
+            else if (pid == -1 && errno == ECHILD)
+                job.pids[index] = 0;
+            else
+                done = false;
+        }
+
+        return (done);
+    }
+
+    static void await(Job &job)
+    {
+        for (auto &worker : job.workers)
+        {
+            if (!worker.thread.joinable())
+                continue;
+
+            worker.thread.join();
+            job.codes[worker.index] = worker.outcome->code;
+        }
+
+        for (size_t index = 0; index < job.pids.size(); ++index)
+        {
+            if (job.pids[index] == 0)
+                continue;
+
+            int wait_status = 0;
+            pid_t pid;
+            while ((pid = waitpid(job.pids[index], &wait_status, 0)) == -1 && errno == EINTR)
+                ;
+
+            job.codes[index] = pid == -1 ? 127 : launcher::to_exit_code(wait_status);
+            job.pids[index] = 0;
+        }
+    }
+
+    static bool write_all(int fd, const char *data, size_t size)
+    {
+        for (size_t written = 0; written < size;)
+        {
+            ssize_t count = ::write(fd, data + written, size - written);
+            if (count == -1 && errno == EINTR)
+                continue;
+
+            if (count <= 0)
+                return (false);
+
+            written += count;
+        }
+
+        return (true);
+    }
+
+    // the captures are regular files, so the kernel moves them without passing through the shell
+    static void drain(int capture, int fd)
+    {
+        struct stat status;
+        if (fstat(capture, &status) == -1)
+            return;
+
+        off_t offset = 0;
+        while (offset < status.st_size)
+        {
+            ssize_t size = sendfile(fd, capture, &offset, status.st_size - offset);
+            if (size == -1 && errno == EINTR)
+                continue;
+
+            // sendfile refuses some destinations, such as files opened for appending
+            if (size == -1 && (errno == EINVAL || errno == ENOSYS))
+                break;
+
+            if (size <= 0)
+                return;
+        }
+
+        char buffer[READ_SIZE];
+        while (offset < status.st_size)
+        {
+            ssize_t size = pread(capture, buffer, std::min<off_t>(sizeof(buffer), status.st_size - offset), offset);
+            if (size == -1 && errno == EINTR)
+                continue;
+
+            if (size <= 0 || !write_all(fd, buffer, size))
+                return;
+
+            offset += size;
+        }
+    }
+
+    // a job's output is held back until it is done and then written in one piece, so jobs never interleave
+    static int finish(Job &job, int output, int error)
+    {
+        drain(job.output, output);
+        drain(job.error, error);
+
+        close(job.output);
+        close(job.error);
+
+        return (job.codes.empty() ? 0 : job.codes.back());
+    }
+
+    int run(std::vector<std::string> lines, int input, size_t slots, int output, int error)
+    {
+        Source source = {
+            .lines = std::deque<std::string>(std::make_move_iterator(lines.begin()), std::make_move_iterator(lines.end())),
+            .partial = {},
+            .fd = input,
+            .exhausted = input == -1};
+
+        int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if (null_fd == -1)
+        {
+            perror("parallel: /dev/null");
+            return (1);
+        }
+
+        int wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (wake == -1)
+        {
+            perror("parallel: eventfd");
+            close(null_fd);
+            return (1);
+        }
+
+        std::vector<Job> running;
+        size_t failures = 0;
+        bool interrupted = false;
+
+        // at the prompt ^C goes to the oldest job's group, its death of SIGINT then stops the others
+        bool foreground = terminal::is_interactive() && tcgetpgrp(STDIN_FILENO) == getpgrp();
+        pid_t owner = 0;
+
+        auto complete = [&](Job &job)
+        {
+            int code = finish(job, output, error);
+
+            if (code != 0)
+                ++failures;
+
+            // like an interrupted loop, nothing new is started once a job died of ^C, and the others are stopped too
+            if (code == 128 + SIGINT && !interrupted)
+            {
+                interrupted = true;
+
+                for (const auto &other : running)
+                {
+                    if (other.process_group != 0 && other.process_group != job.process_group)
+                        kill(-other.process_group, SIGINT);
+                }
+            }
+        };
+
+        while (true)
+        {
+            while (!interrupted && running.size() < slots && !source.lines.empty())
+            {
+                Job job = {
+                    .pids = {},
+                    .codes = {},
+                    .workers = {},
+                    .process_group = 0,
+                    .output = memfd_create("parallel-output", MFD_CLOEXEC),
+                    .error = memfd_create("parallel-error", MFD_CLOEXEC)};
+
+                if (job.output == -1 || job.error == -1)
+                {
+                    perror("parallel: memfd_create");
+                    job.codes = {1};
+                }
+                else
+                    start(source.lines.front(), null_fd, job, wake);
+
+                source.lines.pop_front();
+
+                if (collect(job))
+                    complete(job);
+                else
+                    running.push_back(std::move(job));
+            }
+
+            // a job made only of builtins has no group to hand the terminal to
+            if (foreground && !running.empty() && running.front().process_group != 0 && owner != running.front().process_group)
+            {
+                owner = running.front().process_group;
+                terminal::give(owner);
+            }
+
+            bool wants_input = !interrupted && !source.exhausted && running.size() < slots;
+            if (running.empty() && !wants_input)
+                break;
+
+            int signal_fd = jobs::descriptor();
+
+            // without a signalfd to wake up on, the oldest job is waited for in turn
+            if (signal_fd == -1 && !wants_input)
+            {
+                await(running.front());
+                complete(running.front());
+                running.erase(running.begin());
+                continue;
+            }
+
+            pollfd fds[3];
+            nfds_t count = 0;
+
+            if (wants_input)
+                fds[count++] = pollfd{.fd = source.fd, .events = POLLIN, .revents = 0};
+
+            if (!running.empty() && signal_fd != -1)
+                fds[count++] = pollfd{.fd = signal_fd, .events = POLLIN, .revents = 0};
+
+            if (!running.empty())
+                fds[count++] = pollfd{.fd = wake, .events = POLLIN, .revents = 0};
+
+            if (poll(fds, count, -1) == -1 && errno != EINTR)
+            {
+                perror("poll");
+                break;
+            }
+
+            if (wants_input && fds[0].revents != 0)
+                fill(source);
+
+            if (running.empty())
+                continue;
+
+            eventfd_t finished;
+            eventfd_read(wake, &finished);
+
+            // SIGCHLD does not say who exited and several coalesce into one, so every running job is asked
+            jobs::update();
+
+            for (auto iterator = running.begin(); iterator != running.end();)
+            {
+                if (!collect(*iterator))
+                {
+                    ++iterator;
+                    continue;
+                }
+
+                complete(*iterator);
+                iterator = running.erase(iterator);
+            }
+        }
+
+        for (auto &job : running)
+        {
+            await(job);
+            complete(job);
+        }
+
+        if (owner != 0)
+            terminal::reclaim();
+
+        close(wake);
+        close(null_fd);
+
+        return ((int)std::min<size_t>(failures, MAX_FAILURES));
+    }
+}
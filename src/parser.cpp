@@ -1,12 +1,24 @@
 #include "shell.hpp"
 
+#include <algorithm>
+
 #define END '\0'
 #define SPACE ' '
+#define NEWLINE '\n'
+#define TAB '\t'
+#define DASH '-'
 #define SINGLE '\''
 #define DOUBLE '"'
 #define BACKSLASH '\\'
 #define GREATER_THAN '>'
+#define LESS_THAN '<'
 #define PIPE '|'
+#define AMPERSAND '&'
+#define SEMICOLON ';'
+#define DOLLAR '$'
+#define HASH '#'
+#define OPEN_BRACE '{'
+#define CLOSE_BRACE '}'
 
 namespace parsing
 {
@@ -15,100 +27,236 @@ namespace parsing
           end(line.end()),
           commands(),
           arguments(),
-          redirects()
+          redirects(),
+          arena(),
+          token_start(line.end()),
+          token_length(0),
+          token_in_arena(false),
+          documents(),
+          documents_cursor(line.end()),
+          terminator(),
+          expanded(false)
     {
+        arena.reserve(line.length());
     }
 
-    std::list<parsing::ParsedLine> LineParser::parse(void)
+    // one pipeline at a time, so that its words are expanded only once the ones before it have run
+    std::optional<Pipeline> LineParser::next_pipeline(void)
     {
-        std::optional<std::string> argument;
-        while (argument = next_argument())
-            arguments.push_back(argument.value());
+        tracing::Span span("parse");
+
+        do
+        {
+            terminator.reset();
+
+            std::optional<std::string_view> argument;
+            while ((argument = next_argument()))
+                arguments.emplace_back(argument.value());
 
-        if (!arguments.empty())
             pipe();
 
-        return (commands);
+            // an empty element, as in a leading or doubled ';', is skipped
+            if (!commands.empty())
+            {
+                Pipeline pipeline = {
+                    .commands = std::move(commands),
+                    .connector = terminator.value_or(Connector::SEQUENCE)};
+
+                commands.clear();
+                return (pipeline);
+            }
+        } while (terminator.has_value());
+
+        return (std::nullopt);
+    }
+
+    std::vector<Pipeline> LineParser::parse(void)
+    {
+        std::vector<Pipeline> pipelines;
+
+        std::optional<Pipeline> pipeline;
+        while ((pipeline = next_pipeline()))
+            pipelines.push_back(std::move(pipeline.value()));
+
+        return (pipelines);
+    }
+
+    bool LineParser::complete(void) const
+    {
+        return (std::all_of(documents.begin(), documents.end(), [](const HereDocument &document)
+                            { return (document.closed); }));
+    }
+
+    // what a line expands to can change between runs, the rest of its parse cannot
+    bool LineParser::cacheable(void) const
+    {
+        return (!expanded);
     }
 
-    std::optional<std::string> LineParser::next_argument()
+    std::optional<std::string_view> LineParser::next_argument()
     {
-        std::string builder;
+        reset_token();
 
         char character;
-        while ((character = next()) != END)
+        while (!terminator.has_value() && (character = next()) != END)
         {
             switch (character)
             {
             case SPACE:
             {
-                if (!builder.empty())
-                    return (std::optional(builder));
+                if (!token_empty())
+                    return (token_in_arena ? std::string_view(arena) : std::string_view(&*token_start, token_length));
+
+                break;
+            }
+
+            case NEWLINE:
+            {
+                if (!token_empty())
+                {
+                    unread();
+                    return (token_in_arena ? std::string_view(arena) : std::string_view(&*token_start, token_length));
+                }
+
+                // the bodies were read along with their operators, the next command follows them
+                if (!documents.empty() && documents_cursor > iterator)
+                    iterator = documents_cursor;
+
+                terminator = Connector::SEQUENCE;
 
                 break;
             }
 
             case BACKSLASH:
             {
-                backslash(builder, false);
+                backslash(builder(), false);
 
                 break;
             }
 
             case SINGLE:
             {
+                std::string &quoted = builder();
                 while ((character = next()) != END && character != SINGLE)
-                    builder.push_back(character);
+                    quoted.push_back(character);
 
                 break;
             }
 
             case DOUBLE:
             {
+                std::string &quoted = builder();
                 while ((character = next()) != END && character != DOUBLE)
                 {
                     if (character == BACKSLASH)
-                        backslash(builder, true);
+                        backslash(quoted, true);
+                    else if (character == DOLLAR)
+                        dollar(quoted);
                     else
-                        builder.push_back(character);
+                        quoted.push_back(character);
                 }
 
                 break;
             }
 
-            case GREATER_THAN:
+            case DOLLAR:
             {
-                redirect(StandardNamedStream::OUTPUT);
+                dollar(builder());
 
                 break;
             }
 
+            case GREATER_THAN:
+            case LESS_THAN:
             case PIPE:
+            case AMPERSAND:
+            case SEMICOLON:
             {
-                pipe();
+                if (!token_empty())
+                {
+                    unread();
+                    return (token_in_arena ? std::string_view(arena) : std::string_view(&*token_start, token_length));
+                }
+
+                if (character == SEMICOLON)
+                    terminator = Connector::SEQUENCE;
+                else if (character == AMPERSAND && peek() == AMPERSAND)
+                {
+                    next();
+                    terminator = Connector::AND;
+                }
+                else if (character == AMPERSAND)
+                    terminator = Connector::BACKGROUND;
+                else if (character == PIPE && peek() == PIPE)
+                {
+                    next();
+                    terminator = Connector::OR;
+                }
+                else if (character == PIPE)
+                    pipe();
+                else if (character == LESS_THAN)
+                    redirect(StandardNamedStream::INPUT, character);
+                else
+                    redirect(StandardNamedStream::OUTPUT, character);
 
                 break;
             }
 
             default:
             {
-                if (std::isdigit(character) && peek() == GREATER_THAN)
+                if (token_empty() && character == HASH)
                 {
-                    next();
-                    redirect(get_steam_name_from_fd(character));
+                    while (next() != END)
+                        ;
                 }
+                else if (token_empty() && std::isdigit(character) && (peek() == GREATER_THAN || peek() == LESS_THAN))
+                    redirect(get_steam_name_from_fd(character), next());
+                else if (token_in_arena)
+                    arena.push_back(character);
                 else
-                    builder.push_back(character);
+                {
+                    if (token_length == 0)
+                        token_start = iterator;
+
+                    ++token_length;
+                }
 
                 break;
             }
             }
         }
 
-        if (!builder.empty())
-            return (std::optional(builder));
+        if (!token_empty())
+            return (token_in_arena ? std::string_view(arena) : std::string_view(&*token_start, token_length));
 
-        return (std::optional<std::string>());
+        return (std::nullopt);
+    }
+
+    void LineParser::reset_token(void)
+    {
+        token_start = end;
+        token_length = 0;
+        token_in_arena = false;
+    }
+
+    std::string &LineParser::builder(void)
+    {
+        if (!token_in_arena)
+        {
+            if (token_length != 0)
+                arena.assign(token_start, token_start + token_length);
+            else
+                arena.clear();
+
+            token_in_arena = true;
+        }
+
+        return (arena);
+    }
+
+    bool LineParser::token_empty(void) const
+    {
+        return (token_in_arena ? arena.empty() : token_length == 0);
     }
 
     void LineParser::backslash(std::string &builder, bool in_quote)
@@ -132,31 +280,267 @@ namespace parsing
 
     char LineParser::map_backslash_character(char character)
     {
-        if (character == BACKSLASH || character == DOUBLE)
+        if (character == BACKSLASH || character == DOUBLE || character == DOLLAR)
             return (character);
 
         return (END);
     }
 
-    void LineParser::redirect(StandardNamedStream stream_name)
+    void LineParser::dollar(std::string &builder)
+    {
+        std::string name;
+
+        char character = peek();
+        if (character == '?' || character == '!')
+            name.push_back(next());
+        else if (character == OPEN_BRACE)
+        {
+            next();
+
+            while ((character = next()) != END && character != CLOSE_BRACE)
+                name.push_back(character);
+        }
+        else
+        {
+            while (std::isalnum(character = peek()) || character == '_')
+                name.push_back(next());
+        }
+
+        if (name.empty())
+        {
+            builder.push_back(DOLLAR);
+            return;
+        }
+
+        expanded = true;
+        builder += variables::get(name).value_or("");
+    }
+
+    void LineParser::redirect(StandardNamedStream stream_name, char operation)
     {
-        bool append = peek() == GREATER_THAN;
-        if (append)
+        if (operation == LESS_THAN && peek() == LESS_THAN)
+        {
             next();
 
-        std::string path = next_argument().value();
+            if (peek() == LESS_THAN)
+            {
+                next();
+                here_string(stream_name);
+            }
+            else
+                here_document(stream_name);
+
+            return;
+        }
+
+        // >&N and <&N copy a descriptor, the & must not be taken for a background operator
+        if (peek() == AMPERSAND)
+        {
+            next();
+            duplicate(stream_name, operation);
+            return;
+        }
+
+        RedirectMode mode = operation == LESS_THAN ? RedirectMode::READ : RedirectMode::TRUNCATE;
+
+        if (peek() == GREATER_THAN)
+        {
+            next();
+            mode = operation == LESS_THAN ? RedirectMode::READ_WRITE : RedirectMode::APPEND;
+        }
+
+        std::optional<std::string_view> path = next_argument();
+        if (!path.has_value())
+        {
+            reset_token();
+            return;
+        }
+
+        redirects.push_back(Redirect{
+            .stream_name = stream_name,
+            .path = std::string(path.value()),
+            .mode = mode,
+            .document = {}});
+
+        reset_token();
+    }
+
+    void LineParser::duplicate(StandardNamedStream stream_name, char operation)
+    {
+        std::optional<std::string_view> word = next_argument();
+        if (!word.has_value())
+        {
+            reset_token();
+            return;
+        }
+
+        std::string target(word.value());
+        reset_token();
+
+        if (!target.empty() && std::all_of(target.begin(), target.end(), ::isdigit))
+        {
+            redirects.push_back(Redirect{
+                .stream_name = stream_name,
+                .path = std::move(target),
+                .mode = RedirectMode::DUPLICATE,
+                .document = {}});
+
+            return;
+        }
+
+        // like bash, >&file sends both outputs to the file
+        RedirectMode mode = operation == LESS_THAN ? RedirectMode::READ : RedirectMode::TRUNCATE;
+
+        redirects.push_back(Redirect{
+            .stream_name = stream_name,
+            .path = target,
+            .mode = mode,
+            .document = {}});
+
+        if (operation == GREATER_THAN && stream_name == StandardNamedStream::OUTPUT)
+        {
+            redirects.push_back(Redirect{
+                .stream_name = StandardNamedStream::ERROR,
+                .path = "1",
+                .mode = RedirectMode::DUPLICATE,
+                .document = {}});
+        }
+    }
+
+    void LineParser::here_string(StandardNamedStream stream_name)
+    {
+        std::optional<std::string_view> word = next_argument();
+        if (!word.has_value())
+        {
+            reset_token();
+            return;
+        }
+
+        redirects.push_back(Redirect{
+            .stream_name = stream_name,
+            .path = {},
+            .mode = RedirectMode::HERE_STRING,
+            .document = std::string(word.value()) + NEWLINE});
+
+        reset_token();
+    }
+
+    void LineParser::here_document(StandardNamedStream stream_name)
+    {
+        bool strip_tabs = peek() == DASH;
+        if (strip_tabs)
+            next();
+
+        std::string::const_iterator start = iterator;
+
+        std::optional<std::string_view> delimiter = next_argument();
+        if (!delimiter.has_value())
+        {
+            reset_token();
+            return;
+        }
+
+        // quoting any part of the delimiter leaves the body as written
+        std::string::const_iterator stop = iterator == end ? end : std::next(iterator);
+        bool quoted = std::any_of(std::next(start), stop, [](char character)
+                                  { return (character == SINGLE || character == DOUBLE || character == BACKSLASH); });
+
+        HereDocument document = {
+            .delimiter = std::string(delimiter.value()),
+            .strip_tabs = strip_tabs,
+            .expand = !quoted,
+            .closed = false,
+            .body = {}};
+
+        read_here_document(document);
 
         redirects.push_back(Redirect{
             .stream_name = stream_name,
-            .path = path,
-            .append = append});
+            .path = {},
+            .mode = RedirectMode::HERE_DOCUMENT,
+            .document = std::move(document.body)});
+
+        documents.push_back(std::move(document));
+
+        reset_token();
+    }
+
+    // the bodies follow the line that asked for them, in the order of their operators
+    void LineParser::read_here_document(HereDocument &document)
+    {
+        std::string::const_iterator resume = iterator;
+
+        // an operator on a later line than the bodies read so far starts again after its own line
+        iterator = documents.empty() || iterator > documents_cursor ? std::find(iterator, end, NEWLINE) : documents_cursor;
+
+        while (!document.closed && iterator != end && std::next(iterator) != end)
+        {
+            std::string::const_iterator line_start = std::next(iterator);
+            std::string::const_iterator line_end = std::find(line_start, end, NEWLINE);
+
+            if (document.strip_tabs)
+            {
+                while (line_start != line_end && *line_start == TAB)
+                    ++line_start;
+            }
+
+            if (std::string_view(line_start, line_end) == document.delimiter)
+                document.closed = true;
+            else
+                read_here_document_line(document, line_start, line_end);
+
+            iterator = line_end;
+        }
+
+        documents_cursor = iterator;
+        iterator = resume;
+    }
+
+    void LineParser::read_here_document_line(HereDocument &document, std::string::const_iterator line_start, std::string::const_iterator line_end)
+    {
+        if (!document.expand)
+        {
+            document.body.append(line_start, line_end).push_back(NEWLINE);
+            return;
+        }
+
+        // an expansion ends with its line, an unclosed ${ must not run on into the rest of the input
+        std::string::const_iterator input_end = end;
+        end = line_end;
+
+        for (iterator = line_start; iterator < line_end; ++iterator)
+        {
+            char character = *iterator;
+
+            if (character == DOLLAR)
+            {
+                dollar(document.body);
+
+                if (iterator == line_end)
+                    break;
+            }
+            else if (character == BACKSLASH && std::next(iterator) < line_end && (iterator[1] == DOLLAR || iterator[1] == BACKSLASH || iterator[1] == '`'))
+                document.body.push_back(*++iterator);
+            else
+                document.body.push_back(character);
+        }
+
+        end = input_end;
+
+        document.body.push_back(NEWLINE);
     }
 
     void LineParser::pipe(void)
     {
+        if (arguments.empty())
+        {
+            redirects.clear();
+            return;
+        }
+
         commands.push_back(ParsedLine{
-            .arguments = arguments,
-            .redirects = redirects});
+            .arguments = std::move(arguments),
+            .redirects = std::move(redirects)});
 
         arguments.clear();
         redirects.clear();
@@ -173,6 +557,11 @@ namespace parsing
         return (*iterator);
     }
 
+    void LineParser::unread(void)
+    {
+        --iterator;
+    }
+
     char LineParser::peek(void)
     {
         std::string::const_iterator next = iterator;
@@ -187,11 +576,24 @@ namespace parsing
 
     StandardNamedStream LineParser::get_steam_name_from_fd(char character)
     {
-        if (character == '1')
+        if (character == '0')
+            return (StandardNamedStream::INPUT);
+        else if (character == '1')
             return (StandardNamedStream::OUTPUT);
         else if (character == '2')
             return (StandardNamedStream::ERROR);
         else
             return (StandardNamedStream::UNKNOWN);
     }
-}
\ No newline at end of file
+
+    bool needs_more_input(const std::string &text)
+    {
+        if (text.find("<<") == std::string::npos)
+            return (false);
+
+        LineParser parser(text);
+        parser.parse();
+
+        return (!parser.complete());
+    }
+}
@@ -1,64 +1,138 @@
+#include <algorithm>
+#include <climits>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <fcntl.h>
+#include <csignal>
 #include <sys/wait.h>
+#include <thread>
 
 #include "shell.hpp"
 
-static int _exec(const parsing::ParsedLine &command)
+typedef struct
 {
-    RedirectedStreams streams(command.redirects);
-    if (!streams.valid())
-        return (1);
+    pid_t pid;
+    size_t index;
+    std::string_view program;
+    uint64_t started;
+} Stage;
 
-    const std::vector<std::string> &arguments = command.arguments;
-    const std::string &program = arguments[0];
+// a stopped pipeline leaves its builtin stages running, so each one holds its own result
+typedef struct
+{
+    int code;
+    rusage usage;
+} Outcome;
+
+typedef struct
+{
+    std::thread thread;
+    size_t index;
+    std::shared_ptr<Outcome> outcome;
+} Worker;
+
+#define PIPE_MAX_SIZE_PATH "/proc/sys/fs/pipe-max-size"
 
-    builtins::registry_map::iterator builtin = builtins::REGISTRY.find(program);
-    if (builtin != builtins::REGISTRY.end())
+// zero keeps the kernel's default
+static size_t requested_pipe_size = 0;
+
+void set_pipe_size(size_t size)
+{
+    requested_pipe_size = size;
+}
+
+size_t pipe_size(void)
+{
+    return (requested_pipe_size);
+}
+
+// the most an unprivileged process may ask for, it only changes by hand so it is read once
+static size_t pipe_max_size(void)
+{
+    static size_t maximum = []()
     {
-        builtin->second(arguments, streams);
+        size_t value = 0;
+
+        std::ifstream file(PIPE_MAX_SIZE_PATH);
+        if (!(file >> value) || value == 0)
+            value = 1024 * 1024;
+
+        return (value);
+    }();
+
+    return (maximum);
+}
+
+int open_pipe(int pipe_fds[2])
+{
+    if (pipe2(pipe_fds, O_CLOEXEC) == -1)
+        return (-1);
+
+    size_t size = std::min<size_t>(requested_pipe_size, INT_MAX);
+    if (size == 0)
         return (0);
-    }
 
-    std::string path;
-    if (!locate(program, path))
-    {
-        std::cout << program << ": command not found" << std::endl;
-        return (1);
-    }
+    // a size past the limit is clamped to it, a pipe that cannot grow at all keeps the default
+    if (fcntl(pipe_fds[1], F_SETPIPE_SZ, (int)size) == -1 && errno == EPERM && size > pipe_max_size())
+        fcntl(pipe_fds[1], F_SETPIPE_SZ, (int)pipe_max_size());
 
-    pid_t pid = fork();
-    if (pid == -1)
+    return (0);
+}
+
+// builtins run inside the shell, so their share of its usage is measured on their own thread
+static int call_builtin(const builtins::registry_map::iterator &builtin, const parsing::ParsedLine &command, const RedirectedStreams &streams, rusage *usage)
+{
+    tracing::Span span("builtin", builtin->first);
+
+    rusage before;
+    if (usage != nullptr)
+        getrusage(RUSAGE_THREAD, &before);
+
+    builtin->second(command.arguments, streams);
+
+    if (usage != nullptr)
     {
-        perror("fork");
-        return (1);
+        rusage after;
+        getrusage(RUSAGE_THREAD, &after);
+        *usage = timing::difference(before, after);
     }
-    else if (pid == 0)
-    {
-        size_t size = arguments.size();
 
-        char *argv[size + 1];
-        argv[size] = NULL;
+    return (builtins::take_exit_code());
+}
+
+// the command is copied, the thread may outlive the line it came from once the pipeline is stopped
+static Worker run_builtin(const builtins::registry_map::iterator &builtin, const parsing::ParsedLine &command, size_t index, int fd_in, int fd_out, bool measure)
+{
+    std::shared_ptr<Outcome> outcome = std::make_shared<Outcome>(Outcome{.code = 1, .usage = {}});
 
-        for (size_t index = 0; index < size; ++index)
-            argv[index] = const_cast<char *>(arguments[index].c_str());
+    // counted before the thread starts, so that a builtin later in the pipeline already sees it
+    ++builtins::running_threads;
 
-        dup2(streams.output(), STDOUT_FILENO);
-        dup2(streams.error(), STDERR_FILENO);
+    std::thread thread([builtin, command, fd_in, fd_out, outcome, measure]()
+                       {
+                           {
+                               RedirectedStreams streams(command.redirects, fd_in, fd_out);
 
-        streams.close();
+                               if (streams.valid())
+                                   outcome->code = call_builtin(builtin, command, streams, measure ? &outcome->usage : nullptr);
+                           }
 
-        execvp(path.c_str(), argv);
-        perror("execvp");
-        exit(1);
-    }
-    else
-        waitpid(pid, NULL, 0);
+                           if (fd_in != STDIN_FILENO)
+                               close(fd_in);
 
-    // TODO Return waitpid's exit code
-    return (0);
+                           if (fd_out != STDOUT_FILENO)
+                               close(fd_out);
+
+                           --builtins::running_threads; });
+
+    return (Worker{.thread = std::move(thread), .index = index, .outcome = std::move(outcome)});
 }
 
-static pid_t spawn(int fd_in, int fd_out, const parsing::ParsedLine &command)
+// a builtin that changes the shell's state gets a child of its own in a pipeline, so that like in bash the change stays there,
+// and at the prompt one that may wait on input gets one too, in the job's group where ^C and ^Z reach it
+static pid_t fork_builtin(const builtins::registry_map::iterator &builtin, const parsing::ParsedLine &command, int fd_in, int fd_out, std::optional<pid_t> process_group)
 {
     pid_t pid = fork();
     if (pid == -1)
@@ -68,50 +142,329 @@ static pid_t spawn(int fd_in, int fd_out, const parsing::ParsedLine &command)
     }
     else if (pid == 0)
     {
+        if (process_group.has_value())
+            setpgid(0, process_group.value());
+
+        jobs::enter_subshell();
+
         dup2(fd_in, STDIN_FILENO);
         dup2(fd_out, STDOUT_FILENO);
 
-        exit(_exec(command));
+        // the pipe ends held by builtin threads were copied too, a reader must see its end of file without waiting for us
+        close_range(STDERR_FILENO + 1, ~0U, 0);
+        jobs::initialize();
+
+        int code = 1;
+        {
+            RedirectedStreams streams(command.redirects);
+            if (streams.valid())
+            {
+                std::optional<int> shell_exit_code = builtin->second(command.arguments, streams);
+                code = shell_exit_code.value_or(builtins::take_exit_code());
+            }
+        }
+
+        std::cout.flush();
+        _exit(code);
     }
 
+    // set from both sides so that the group exists before anyone waits on it
+    if (process_group.has_value())
+        setpgid(pid, process_group.value() == 0 ? pid : process_group.value());
+
     return (pid);
 }
 
-pid_t pipeline(const std::list<parsing::ParsedLine> &commands)
+static pid_t spawn(const parsing::ParsedLine &command, const RedirectedStreams &streams, std::optional<pid_t> process_group)
 {
-    pid_t pid = fork();
-    if (pid == -1)
+    const std::vector<std::string> &arguments = command.arguments;
+    const std::string &program = arguments[0];
+
+    std::string path;
+    if (!locate(program, path))
     {
-        perror("fork");
+        std::cout << program << ": command not found" << std::endl;
         return (-1);
     }
-    else if (pid == 0)
+
+    return (launcher::launch(path, arguments, streams, process_group));
+}
+
+// returns the stages that were still running when the pipeline got stopped, which then become a job
+static std::vector<pid_t> reap(pid_t process_group, std::vector<Stage> &stages, std::vector<int> &codes, std::vector<rusage> *usages)
+{
+    std::map<pid_t, const Stage *> pending;
+    for (const auto &stage : stages)
+        pending.emplace(stage.pid, &stage);
+
+    while (!pending.empty())
     {
-        int fd_in = STDIN_FILENO;
+        int wait_status = 0;
+        rusage usage;
+
+        pid_t pid;
+        {
+            tracing::Span span("waitpid");
+            pid = wait4(-process_group, &wait_status, WUNTRACED, &usage);
+        }
 
-        auto iterator = commands.begin();
-        for (size_t index = 0; index < commands.size() - 1; ++index)
+        if (pid == -1)
         {
-            const parsing::ParsedLine &command = *iterator++;
+            if (errno == EINTR)
+                continue;
 
-            int pipe_fds[2];
-            pipe(pipe_fds);
+            break;
+        }
 
-            spawn(fd_in, pipe_fds[1], command);
+        if (WIFSTOPPED(wait_status))
+        {
+            std::vector<pid_t> running;
+            for (const auto &[pending_pid, stage] : pending)
+            {
+                running.push_back(pending_pid);
+                codes[stage->index] = 128 + WSTOPSIG(wait_status);
+            }
 
-            close(pipe_fds[1]);
+            return (running);
+        }
+
+        auto iterator = pending.find(pid);
+        if (iterator == pending.end())
+            continue;
+
+        const Stage &stage = *iterator->second;
+        codes[stage.index] = launcher::to_exit_code(wait_status);
+
+        if (usages != nullptr)
+            (*usages)[stage.index] = usage;
+
+        // the child cannot report its own spans, its lifetime as seen from the shell stands in for exec
+        if (stage.started != 0)
+            tracing::record("exec", stage.program, stage.started, tracing::now());
+
+        pending.erase(iterator);
+    }
+
+    return {};
+}
+
+static std::string describe(std::span<const parsing::ParsedLine> commands)
+{
+    std::string description;
+
+    for (const auto &command : commands)
+    {
+        if (!description.empty())
+            description += " | ";
+
+        for (size_t index = 0; index < command.arguments.size(); ++index)
+        {
+            if (index != 0)
+                description += ' ';
+
+            description += command.arguments[index];
+        }
+    }
+
+    return (description);
+}
+
+static pid_t launch_stages(std::span<const parsing::ParsedLine> commands, std::vector<int> &codes, std::vector<Stage> &stages, std::vector<Worker> &workers, std::vector<rusage> *usages, bool foreground)
+{
+    // a subshell keeps every stage in its own group, so that the job it stands for can be signalled as a whole,
+    // and without job control a foreground pipeline stays in the shell's group, like bash does in scripts
+    bool own_group = !jobs::in_subshell() && (terminal::is_interactive() || !foreground);
+    pid_t process_group = own_group ? 0 : getpgrp();
+
+    int fd_in = STDIN_FILENO;
+
+    size_t index = 0;
+    for (auto iterator = commands.begin(); iterator != commands.end(); ++iterator, ++index)
+    {
+        const parsing::ParsedLine &command = *iterator;
+        bool last = std::next(iterator) == commands.end();
+
+        int pipe_fds[2] = {-1, STDOUT_FILENO};
+        if (!last && open_pipe(pipe_fds) == -1)
+        {
+            perror("pipe");
+            break;
+        }
+
+        builtins::registry_map::iterator builtin = builtins::REGISTRY.find(command.arguments[0]);
+        bool forked = builtin != builtins::REGISTRY.end() && ((commands.size() > 1 && !builtins::is_pure(builtin->first)) ||
+                                                             (foreground && terminal::is_interactive() && builtins::waits_on_input(builtin->first)));
+
+        if (!last && builtin != builtins::REGISTRY.end() && !forked)
+        {
+            // the thread owns both ends and closes them once the builtin returns
+            workers.push_back(run_builtin(builtin, command, index, fd_in, pipe_fds[1], usages != nullptr));
 
             fd_in = pipe_fds[0];
+            continue;
         }
 
-        dup2(fd_in, STDIN_FILENO);
+        {
+            // a forked builtin opens its redirects in the child
+            std::optional<RedirectedStreams> streams;
+            if (!forked)
+                streams.emplace(command.redirects, fd_in, pipe_fds[1]);
+
+            if (streams.has_value() && !streams->valid())
+                codes[index] = 1;
+            else if (streams.has_value() && builtin != builtins::REGISTRY.end())
+                codes[index] = call_builtin(builtin, command, *streams, usages ? &(*usages)[index] : nullptr);
+            else
+            {
+                uint64_t started = tracing::active.load(std::memory_order_relaxed) ? tracing::now() : 0;
+
+                std::optional<pid_t> group = own_group ? std::optional(process_group) : std::nullopt;
+                pid_t pid = forked ? fork_builtin(builtin, command, fd_in, pipe_fds[1], group) : spawn(command, *streams, group);
+                if (pid != -1)
+                {
+                    if (process_group == 0)
+                    {
+                        process_group = pid;
+
+                        if (foreground)
+                            terminal::give(process_group);
+                    }
+
+                    stages.push_back(Stage{.pid = pid, .index = index, .program = command.arguments[0], .started = started});
+                }
+            }
+        }
 
-        const parsing::ParsedLine &command = commands.back();
-        exit(_exec(command));
+        if (fd_in != STDIN_FILENO)
+            close(fd_in);
+
+        if (!last)
+            close(pipe_fds[1]);
+
+        fd_in = pipe_fds[0];
     }
 
-    int status = 0;
-    waitpid(pid, &status, 0);
+    if (fd_in != STDIN_FILENO && fd_in != -1)
+        close(fd_in);
 
-    return (pid);
+    return (stages.empty() ? 0 : process_group);
+}
+
+static void announce(size_t id, pid_t pid)
+{
+    if (terminal::is_interactive())
+        dprintf(STDERR_FILENO, "[%zu] %d\n", id, pid);
+}
+
+static std::vector<int> run_in_background(std::span<const parsing::ParsedLine> commands)
+{
+    std::vector<int> codes(commands.size(), 0);
+
+    // finished jobs are collected as new ones start, so that a script does not pile up zombies
+    jobs::update();
+
+    bool has_builtin = std::any_of(commands.begin(), commands.end(), [](const parsing::ParsedLine &command)
+                                   { return (builtins::REGISTRY.contains(command.arguments[0])); });
+
+    if (has_builtin)
+    {
+        // builtins run inside the shell, so a background pipeline that has one gets a shell of its own
+        pid_t pid = fork();
+        if (pid == -1)
+        {
+            perror("fork");
+            return (codes);
+        }
+        else if (pid == 0)
+        {
+            setpgid(0, 0);
+            jobs::enter_subshell();
+
+            std::vector<int> subshell_codes = pipeline(commands);
+            std::cout.flush();
+
+            _exit(subshell_codes.back());
+        }
+
+        setpgid(pid, pid);
+
+        announce(jobs::add(pid, describe(commands), {pid}, jobs::State::RUNNING), pid);
+        variables::set_last_background(pid);
+
+        return (codes);
+    }
+
+    std::vector<Stage> stages;
+    std::vector<Worker> workers;
+
+    pid_t process_group = launch_stages(commands, codes, stages, workers, nullptr, false);
+    if (process_group == 0)
+        return (codes);
+
+    std::vector<pid_t> pids;
+    for (const auto &stage : stages)
+        pids.push_back(stage.pid);
+
+    announce(jobs::add(process_group, describe(commands), pids, jobs::State::RUNNING), process_group);
+    variables::set_last_background(pids.back());
+
+    return (codes);
+}
+
+std::vector<int> pipeline(std::span<const parsing::ParsedLine> commands, std::vector<rusage> *usages, bool background)
+{
+    if (background)
+    {
+        std::vector<int> codes = run_in_background(commands);
+        variables::set_pipestatus(codes);
+
+        return (codes);
+    }
+
+    std::vector<int> codes(commands.size(), 127);
+    std::vector<Stage> stages;
+    std::vector<Worker> workers;
+
+    pid_t process_group = launch_stages(commands, codes, stages, workers, usages, true);
+    if (process_group != 0)
+    {
+        std::vector<pid_t> running = reap(process_group, stages, codes, usages);
+        terminal::reclaim();
+
+        // reported at the next prompt, past the ^Z the terminal echoed
+        if (!running.empty() && !jobs::in_subshell())
+        {
+            size_t id = jobs::add(process_group, describe(commands), running, jobs::State::STOPPED);
+            dprintf(STDERR_FILENO, "\n");
+
+            // a builtin feeding a stopped stage would block the shell, it is joined with the job instead
+            auto stopped = std::find_if(stages.begin(), stages.end(), [&running](const Stage &stage)
+                                        { return (stage.pid == running.front()); });
+
+            std::vector<std::thread> threads;
+            for (auto &worker : workers)
+            {
+                codes[worker.index] = codes[stopped->index];
+                threads.push_back(std::move(worker.thread));
+            }
+
+            jobs::adopt(id, std::move(threads));
+            workers.clear();
+        }
+        else if (terminal::is_interactive() && codes.back() == 128 + SIGINT)
+            dprintf(STDERR_FILENO, "\n");
+    }
+
+    for (auto &worker : workers)
+    {
+        worker.thread.join();
+        codes[worker.index] = worker.outcome->code;
+
+        if (usages != nullptr)
+            (*usages)[worker.index] = worker.outcome->usage;
+    }
+
+    variables::set_pipestatus(codes);
+
+    return (codes);
 }
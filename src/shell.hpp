@@ -6,62 +6,160 @@
 #include <map>
 #include <functional>
 #include <optional>
-#include <list>
+#include <string_view>
+#include <span>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <cstdint>
 #include <unistd.h>
+#include <sys/resource.h>
 
-std::vector<std::string> split(std::string haystack, const std::string &needle);
+std::vector<std::string> split(const std::string &haystack, const std::string &needle);
 bool locate(const std::string &program, std::string &output);
+void append_json_escaped(std::string &json, std::string_view string);
+std::optional<unsigned long long> parse_unsigned(const std::string &text);
+std::optional<int> named_descriptor(const std::string &path);
+std::string reopen_path(int fd);
+
+namespace hashing
+{
+    typedef struct
+    {
+        std::string path;
+        size_t hits;
+    } Entry;
+
+    bool find(const std::string &program, std::string &output);
+    void remember(const std::string &program, const std::string &path);
+    bool forget(const std::string &program);
+    void clear(void);
+    std::vector<std::pair<std::string, Entry>> get(void);
+}
 
 enum class StandardNamedStream
 {
     UNKNOWN = -1,
+    INPUT = 0,
     OUTPUT = 1,
     ERROR = 2
 };
 
+enum class RedirectMode
+{
+    TRUNCATE,
+    APPEND,
+    READ,
+    READ_WRITE,
+    HERE_DOCUMENT,
+    HERE_STRING,
+    DUPLICATE,
+};
+
 typedef struct
 {
     StandardNamedStream stream_name;
     std::string path;
-    bool append;
+    RedirectMode mode;
+    std::string document;
 } Redirect;
 
 class RedirectedStreams
 {
 private:
     bool _valid;
+    int _default_input;
+    int _default_output;
+    int _default_error;
+    std::optional<int> _input;
     std::optional<int> _output;
     std::optional<int> _error;
 
 public:
-    RedirectedStreams(const std::vector<Redirect> &redirects);
+    RedirectedStreams(const std::vector<Redirect> &redirects, int default_input = STDIN_FILENO, int default_output = STDOUT_FILENO, int default_error = STDERR_FILENO);
     ~RedirectedStreams();
 
 public:
     void close();
+    int descriptor(int fd) const;
 
     inline bool valid() const
     {
         return (_valid);
     }
 
+    inline int input() const
+    {
+        return (_input.value_or(_default_input));
+    }
+
     inline int output() const
     {
-        return (_output.value_or(STDOUT_FILENO));
+        return (_output.value_or(_default_output));
     }
 
     inline int error() const
     {
-        return (_error.value_or(STDERR_FILENO));
+        return (_error.value_or(_default_error));
     }
 };
 
+// batches builtin output into large writes, what is left is flushed when it goes out of scope
+class BufferedWriter
+{
+private:
+    static const size_t CAPACITY = 64 * 1024;
+
+    int _fd;
+    size_t _size;
+    char _buffer[CAPACITY];
+
+public:
+    BufferedWriter(int fd);
+    ~BufferedWriter();
+
+public:
+    void write(std::string_view data);
+    void number(size_t value, int width = 0);
+    void printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+    bool flush();
+
+    inline void put(char character)
+    {
+        if (_size == CAPACITY)
+            flush();
+
+        _buffer[_size++] = character;
+    }
+};
+
+namespace launcher
+{
+    enum class Strategy
+    {
+        SPAWN,
+        FORK,
+    };
+
+    Strategy get_strategy(void);
+    pid_t launch(const std::string &path, const std::vector<std::string> &arguments, const RedirectedStreams &streams, std::optional<pid_t> process_group);
+    int to_exit_code(int wait_status);
+}
+
 namespace builtins
 {
     using registry_map = std::map<std::string, std::function<std::optional<int>(const std::vector<std::string> &, const RedirectedStreams &)>>;
     extern registry_map REGISTRY;
+    extern registry_map DISABLED;
+    extern std::atomic<size_t> running_threads;
 
     void register_defaults();
+    bool disable(const std::string &name);
+    bool restore(const std::string &name);
+    bool is_pure(const std::string &name);
+    bool waits_on_input(const std::string &name);
+    void set_exit_code(int code);
+    int take_exit_code(void);
 }
 
 namespace parsing
@@ -72,31 +170,94 @@ namespace parsing
         std::vector<Redirect> redirects;
     } ParsedLine;
 
+    typedef struct
+    {
+        std::string delimiter;
+        bool strip_tabs;
+        bool expand;
+        bool closed;
+        std::string body;
+    } HereDocument;
+
+    enum class Connector
+    {
+        SEQUENCE,
+        AND,
+        OR,
+        BACKGROUND,
+    };
+
+    typedef struct
+    {
+        std::vector<parsing::ParsedLine> commands;
+        Connector connector;
+    } Pipeline;
+
     class LineParser
     {
     private:
         std::string::const_iterator iterator;
         std::string::const_iterator end;
-        std::list<parsing::ParsedLine> commands;
+        std::vector<parsing::ParsedLine> commands;
         std::vector<std::string> arguments;
         std::vector<Redirect> redirects;
+        std::string arena;
+        std::string::const_iterator token_start;
+        size_t token_length;
+        bool token_in_arena;
+        std::vector<HereDocument> documents;
+        std::string::const_iterator documents_cursor;
+        std::optional<Connector> terminator;
+        bool expanded;
 
     public:
         LineParser(const std::string &line);
 
     public:
-        std::list<parsing::ParsedLine> parse(void);
+        std::optional<Pipeline> next_pipeline(void);
+        std::vector<Pipeline> parse(void);
+        bool complete(void) const;
+        bool cacheable(void) const;
 
     private:
-        std::optional<std::string> next_argument();
+        std::optional<std::string_view> next_argument();
+        void reset_token(void);
+        std::string &builder(void);
+        bool token_empty(void) const;
         void backslash(std::string &builder, bool in_quote);
         char map_backslash_character(char character);
-        void redirect(StandardNamedStream stream_name);
+        void dollar(std::string &builder);
+        void redirect(StandardNamedStream stream_name, char operation);
+        void duplicate(StandardNamedStream stream_name, char operation);
+        void here_string(StandardNamedStream stream_name);
+        void here_document(StandardNamedStream stream_name);
+        void read_here_document(HereDocument &document);
+        void read_here_document_line(HereDocument &document, std::string::const_iterator line_start, std::string::const_iterator line_end);
         void pipe(void);
         char next(void);
         char peek(void);
+        void unread(void);
         StandardNamedStream get_steam_name_from_fd(char character);
     };
+
+    bool needs_more_input(const std::string &text);
+}
+
+namespace caching
+{
+    typedef struct
+    {
+        size_t hits;
+        size_t misses;
+        size_t size;
+        size_t capacity;
+    } Statistics;
+
+    std::shared_ptr<const std::vector<parsing::Pipeline>> find(const std::string &line);
+    void remember(const std::string &line, std::vector<parsing::Pipeline> pipelines);
+    void resize(size_t size);
+    void clear(void);
+    Statistics statistics(void);
 }
 
 namespace autocompletion
@@ -112,17 +273,159 @@ namespace autocompletion
 }
 
 void prompt();
-pid_t pipeline(const std::list<parsing::ParsedLine> &commands);
+std::optional<int> exec(const parsing::ParsedLine &parsed_line);
+std::optional<int> eval(std::string &line);
+std::vector<int> pipeline(std::span<const parsing::ParsedLine> commands, std::vector<rusage> *usages = nullptr, bool background = false);
+int open_pipe(int pipe_fds[2]);
+void set_pipe_size(size_t size);
+size_t pipe_size(void);
+
+namespace timing
+{
+    rusage difference(const rusage &before, const rusage &after);
+    std::optional<int> time(std::vector<parsing::ParsedLine> &commands);
+}
+
+namespace loadable
+{
+    std::optional<std::string> load(const std::string &path, const std::string &name);
+    bool unload(const std::string &name);
+    bool is_loaded(const std::string &name);
+}
+
+namespace utilities
+{
+    int printf(const std::vector<std::string> &arguments, const RedirectedStreams &streams);
+    int test(const std::vector<std::string> &arguments, const RedirectedStreams &streams);
+    int cat(const std::vector<std::string> &arguments, const RedirectedStreams &streams);
+}
+
+namespace parallel
+{
+    int run(std::vector<std::string> lines, int input, size_t slots, int output, int error);
+}
+
+namespace variables
+{
+    void set_status(int code);
+    void set_pipestatus(const std::vector<int> &codes);
+    void set_last_background(pid_t pid);
+    int status(void);
+    const std::vector<int> &pipestatus(void);
+    std::optional<std::string> get(const std::string &name);
+}
+
+namespace batch
+{
+    int run(int fd);
+    int run_file(const std::string &path);
+    int run_string(const std::string &commands);
+}
+
+namespace terminal
+{
+    void initialize(void);
+    bool is_interactive(void);
+    void give(pid_t process_group);
+    void reclaim(void);
+    void detach(void);
+}
+
+namespace jobs
+{
+    enum class State
+    {
+        RUNNING,
+        STOPPED,
+        DONE,
+    };
+
+    typedef struct
+    {
+        pid_t pid;
+        int code;
+        bool finished;
+    } Process;
+
+    typedef struct
+    {
+        size_t id;
+        pid_t process_group;
+        std::string command;
+        std::vector<Process> processes;
+        State state;
+        bool notified;
+        uint64_t touched;
+    } Job;
+
+    void initialize(void);
+    int descriptor(void);
+    void update(void);
+    void notify(void);
+    size_t add(pid_t process_group, const std::string &command, const std::vector<pid_t> &pids, State state);
+    void adopt(size_t id, std::vector<std::thread> threads);
+    std::vector<Job> list(void);
+    std::optional<size_t> current(size_t offset);
+    std::optional<size_t> resolve(const std::string &specification);
+    std::optional<pid_t> process_group(size_t id);
+    std::string describe(const Job &job, char marker);
+    std::optional<int> foreground(size_t id);
+    bool background(size_t id);
+    std::optional<int> wait(size_t id);
+    int wait_all(void);
+    bool in_subshell(void);
+    void enter_subshell(void);
+}
 
 namespace history
 {
     void initialize(void);
     void finalize(void);
     void add(const std::string &command);
-    const std::vector<std::string> &get();
+    size_t size(void);
+    std::string_view at(size_t position);
+    size_t base(void);
+    std::optional<size_t> search(const std::string &query, size_t before);
+    bool index_pending(void);
+    void index_some(size_t count);
     void read(const std::string &path);
     void write(const std::string &path);
     void append(const std::string &path);
 }
 
+namespace tracing
+{
+    extern std::atomic<bool> active;
+
+    void initialize(void);
+    void start(void);
+    void stop(void);
+    void flush(void);
+    uint64_t now(void);
+    void record(const char *name, std::string_view detail, uint64_t start, uint64_t end);
+
+    // records its own lifetime, a disabled tracer costs a single relaxed load
+    class Span
+    {
+    private:
+        const char *_name;
+        std::string_view _detail;
+        uint64_t _start;
+
+    public:
+        inline Span(const char *name, std::string_view detail = {})
+            : _name(name),
+              _detail(detail),
+              _start(active.load(std::memory_order_relaxed) ? now() : 0)
+        {
+        }
+
+        inline ~Span()
+        {
+            if (_start != 0)
+                record(_name, _detail, _start, now());
+        }
+    };
+}
+
 #endif
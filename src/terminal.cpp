@@ -0,0 +1,56 @@
+#include "shell.hpp"
+
+#include <csignal>
+
+namespace terminal
+{
+    static bool interactive = false;
+    static pid_t shell_process_group = 0;
+
+    void initialize(void)
+    {
+        interactive = isatty(STDIN_FILENO);
+        if (!interactive)
+            return;
+
+        shell_process_group = getpgrp();
+
+        // the shell must be able to take the terminal back from a finished job
+        signal(SIGTTOU, SIG_IGN);
+
+        // job control signals are meant for the foreground job, never for the shell itself
+        signal(SIGINT, SIG_IGN);
+        signal(SIGQUIT, SIG_IGN);
+        signal(SIGTSTP, SIG_IGN);
+        signal(SIGTTIN, SIG_IGN);
+    }
+
+    bool is_interactive(void)
+    {
+        return (interactive);
+    }
+
+    void give(pid_t process_group)
+    {
+        if (!interactive)
+            return;
+
+        tcsetpgrp(STDIN_FILENO, process_group);
+
+        // a stage may already have been stopped by SIGTTIN before it owned the terminal
+        kill(-process_group, SIGCONT);
+    }
+
+    void reclaim(void)
+    {
+        if (!interactive)
+            return;
+
+        tcsetpgrp(STDIN_FILENO, shell_process_group);
+    }
+
+    void detach(void)
+    {
+        interactive = false;
+    }
+}
@@ -0,0 +1,271 @@
+#include "shell.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cctype>
+#include <sys/time.h>
+
+#define TIMEFORMAT_NAME "TIMEFORMAT"
+#define DEFAULT_TIMEFORMAT "\nreal\t%3lR\nuser\t%3lU\nsys\t%3lS"
+#define POSIX_TIMEFORMAT "real %2R\nuser %2U\nsys %2S"
+
+namespace timing
+{
+    typedef struct
+    {
+        double real;
+        double user;
+        double system;
+        long max_rss;
+        long voluntary_switches;
+        long involuntary_switches;
+    } Totals;
+
+    enum class Output
+    {
+        FORMAT,
+        POSIX,
+        JSON,
+    };
+
+    static double seconds(const timeval &time)
+    {
+        return (time.tv_sec + time.tv_usec / 1e6);
+    }
+
+    rusage difference(const rusage &before, const rusage &after)
+    {
+        rusage usage = {};
+
+        timersub(&after.ru_utime, &before.ru_utime, &usage.ru_utime);
+        timersub(&after.ru_stime, &before.ru_stime, &usage.ru_stime);
+
+        // a high-water mark, there is nothing to subtract
+        usage.ru_maxrss = after.ru_maxrss;
+
+        usage.ru_minflt = after.ru_minflt - before.ru_minflt;
+        usage.ru_majflt = after.ru_majflt - before.ru_majflt;
+        usage.ru_inblock = after.ru_inblock - before.ru_inblock;
+        usage.ru_oublock = after.ru_oublock - before.ru_oublock;
+        usage.ru_nvcsw = after.ru_nvcsw - before.ru_nvcsw;
+        usage.ru_nivcsw = after.ru_nivcsw - before.ru_nivcsw;
+
+        return (usage);
+    }
+
+    static void add(Totals &totals, const rusage &usage, bool with_rss)
+    {
+        totals.user += seconds(usage.ru_utime);
+        totals.system += seconds(usage.ru_stime);
+        totals.voluntary_switches += usage.ru_nvcsw;
+        totals.involuntary_switches += usage.ru_nivcsw;
+
+        if (with_rss)
+            totals.max_rss = std::max(totals.max_rss, usage.ru_maxrss);
+    }
+
+    static void append_seconds(std::string &output, double value, int precision, bool long_form)
+    {
+        char buffer[64];
+
+        if (long_form)
+        {
+            int minutes = (int)(value / 60);
+            snprintf(buffer, sizeof(buffer), "%dm%.*fs", minutes, precision, value - minutes * 60);
+        }
+        else
+            snprintf(buffer, sizeof(buffer), "%.*f", precision, value);
+
+        output += buffer;
+    }
+
+    // the TIMEFORMAT escapes of bash, %[p][l]R, U, S and P, plus %M for max RSS and %w and %c for context switches
+    static std::string format(const std::string &format, const Totals &totals)
+    {
+        std::string output;
+
+        for (size_t index = 0; index < format.size(); ++index)
+        {
+            if (format[index] != '%' || index + 1 == format.size())
+            {
+                output += format[index];
+                continue;
+            }
+
+            size_t start = index++;
+
+            int precision = 3;
+            if (std::isdigit(format[index]))
+                precision = std::min(format[index++] - '0', 3);
+
+            bool long_form = index < format.size() && format[index] == 'l';
+            if (long_form)
+                ++index;
+
+            char letter = index < format.size() ? format[index] : '\0';
+            switch (letter)
+            {
+            case '%':
+                output += '%';
+                break;
+            case 'R':
+                append_seconds(output, totals.real, precision, long_form);
+                break;
+            case 'U':
+                append_seconds(output, totals.user, precision, long_form);
+                break;
+            case 'S':
+                append_seconds(output, totals.system, precision, long_form);
+                break;
+            case 'P':
+                append_seconds(output, totals.real > 0 ? (totals.user + totals.system) * 100 / totals.real : 0, precision, false);
+                break;
+            case 'M':
+                output += std::to_string(totals.max_rss);
+                break;
+            case 'w':
+                output += std::to_string(totals.voluntary_switches);
+                break;
+            case 'c':
+                output += std::to_string(totals.involuntary_switches);
+                break;
+            default:
+                output.append(format, start, index - start + 1);
+                break;
+            }
+        }
+
+        output += '\n';
+        return (output);
+    }
+
+    static void append_usage(std::string &json, double user, double system, long max_rss, long voluntary_switches, long involuntary_switches)
+    {
+        char buffer[192];
+        snprintf(buffer, sizeof(buffer), "\"user\":%.6f,\"sys\":%.6f,\"maxrss_kb\":%ld,\"voluntary_switches\":%ld,\"involuntary_switches\":%ld",
+                 user, system, max_rss, voluntary_switches, involuntary_switches);
+
+        json += buffer;
+    }
+
+    // one line per timed command, so that it can be scraped with a line-oriented reader
+    static std::string to_json(const Totals &totals, const std::vector<parsing::ParsedLine> &commands, const std::vector<rusage> &usages, const std::vector<int> &codes)
+    {
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "{\"real\":%.6f,", totals.real);
+
+        std::string json = buffer;
+        append_usage(json, totals.user, totals.system, totals.max_rss, totals.voluntary_switches, totals.involuntary_switches);
+
+        json += ",\"status\":" + std::to_string(codes.empty() ? 0 : codes.back()) + ",\"stages\":[";
+        for (size_t index = 0; index < commands.size(); ++index)
+        {
+            const rusage &usage = usages[index];
+
+            json += index == 0 ? "{\"command\":\"" : ",{\"command\":\"";
+            append_json_escaped(json, commands[index].arguments[0]);
+            json += "\",\"status\":" + std::to_string(codes[index]) + ",";
+            append_usage(json, seconds(usage.ru_utime), seconds(usage.ru_stime), usage.ru_maxrss, usage.ru_nvcsw, usage.ru_nivcsw);
+            json += "}";
+        }
+        json += "]}\n";
+
+        return (json);
+    }
+
+    static Output parse_options(std::vector<std::string> &arguments)
+    {
+        Output output = Output::FORMAT;
+
+        size_t index = 1;
+        for (; index < arguments.size() && arguments[index].starts_with('-'); ++index)
+        {
+            const std::string &option = arguments[index];
+
+            if (option == "-p")
+                output = Output::POSIX;
+            else if (option == "-j")
+                output = Output::JSON;
+            else if (option == "--")
+            {
+                ++index;
+                break;
+            }
+            else
+                break;
+        }
+
+        arguments.erase(arguments.begin(), arguments.begin() + index);
+        return (output);
+    }
+
+    std::optional<int> time(std::vector<parsing::ParsedLine> &commands)
+    {
+        Output output = parse_options(commands.front().arguments);
+
+        if (commands.front().arguments.empty())
+            commands.erase(commands.begin());
+
+        std::vector<rusage> usages(commands.size(), rusage{});
+        std::vector<int> codes;
+        std::optional<int> result;
+
+        rusage self_before;
+        getrusage(RUSAGE_SELF, &self_before);
+
+        auto start = std::chrono::steady_clock::now();
+
+        if (commands.size() == 1 && builtins::REGISTRY.contains(commands.front().arguments[0]))
+        {
+            result = exec(commands.front());
+            codes.push_back(variables::status());
+        }
+        else if (!commands.empty())
+            codes = pipeline(commands, &usages);
+
+        Totals totals = {};
+        totals.real = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        rusage self_after;
+        getrusage(RUSAGE_SELF, &self_after);
+
+        // the shell's own share covers the builtins it ran, their per-stage usage is only reported, not summed
+        rusage self = difference(self_before, self_after);
+        add(totals, self, false);
+
+        for (size_t index = 0; index < commands.size(); ++index)
+        {
+            // a builtin that changes the shell's state ran in a child of its own, like an external stage
+            const std::string &program = commands[index].arguments[0];
+            if (builtins::REGISTRY.contains(program) && (commands.size() == 1 || builtins::is_pure(program)))
+            {
+                if (commands.size() == 1)
+                    usages[index] = self;
+
+                totals.max_rss = std::max(totals.max_rss, usages[index].ru_maxrss);
+            }
+            else
+                add(totals, usages[index], true);
+        }
+
+        std::string report;
+        if (output == Output::JSON)
+            report = to_json(totals, commands, usages, codes);
+        else if (output == Output::POSIX)
+            report = format(POSIX_TIMEFORMAT, totals);
+        else
+        {
+            // an empty TIMEFORMAT silences the report, as in bash
+            std::optional<std::string> timeformat = variables::get(TIMEFORMAT_NAME);
+            if (!timeformat.has_value())
+                report = format(DEFAULT_TIMEFORMAT, totals);
+            else if (!timeformat->empty())
+                report = format(timeformat.value(), totals);
+        }
+
+        dprintf(STDERR_FILENO, "%s", report.c_str());
+
+        return (result);
+    }
+}
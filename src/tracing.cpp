@@ -0,0 +1,141 @@
+#include "shell.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+
+#define TRACE_ENVVAR "SHELL_TRACE"
+
+namespace tracing
+{
+    typedef struct
+    {
+        const char *name;
+        char detail[48];
+        uint64_t start;
+        uint64_t end;
+        pid_t thread;
+    } Event;
+
+    // a power of two so that the slot is a mask of the ever-increasing head, older events get overwritten
+    static const size_t CAPACITY = 1 << 16;
+
+    std::atomic<bool> active = false;
+
+    static Event *ring = nullptr;
+    static std::atomic<uint64_t> head = 0;
+    static std::string path;
+    static pid_t owner = 0;
+
+    uint64_t now(void)
+    {
+        timespec time;
+        clock_gettime(CLOCK_MONOTONIC, &time);
+
+        return ((uint64_t)time.tv_sec * 1000000000 + time.tv_nsec);
+    }
+
+    void record(const char *name, std::string_view detail, uint64_t start, uint64_t end)
+    {
+        static thread_local pid_t thread = gettid();
+
+        uint64_t slot = head.fetch_add(1, std::memory_order_relaxed);
+        Event &event = ring[slot & (CAPACITY - 1)];
+
+        size_t length = std::min(detail.size(), sizeof(event.detail) - 1);
+        std::memcpy(event.detail, detail.data(), length);
+        event.detail[length] = '\0';
+
+        event.name = name;
+        event.start = start;
+        event.end = end;
+        event.thread = thread;
+    }
+
+    void flush(void)
+    {
+        if (ring == nullptr || getpid() != owner)
+            return;
+
+        uint64_t end = head.load(std::memory_order_acquire);
+        uint64_t begin = end > CAPACITY ? end - CAPACITY : 0;
+
+        std::string json = "{\"traceEvents\":[\n";
+        for (uint64_t slot = begin; slot < end; ++slot)
+        {
+            const Event &event = ring[slot & (CAPACITY - 1)];
+
+            char fields[160];
+            snprintf(fields, sizeof(fields), "{\"ph\":\"X\",\"cat\":\"shell\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"name\":\"",
+                     owner, event.thread, event.start / 1e3, (event.end - event.start) / 1e3);
+
+            json += fields;
+            append_json_escaped(json, event.name);
+
+            if (event.detail[0] != '\0')
+            {
+                json += "\",\"args\":{\"detail\":\"";
+                append_json_escaped(json, event.detail);
+                json += "\"}";
+            }
+            else
+                json += '"';
+
+            json += slot + 1 == end ? "}\n" : "},\n";
+        }
+        json += "],\"displayTimeUnit\":\"ms\"}\n";
+
+        int fd = open(path.c_str(), O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd == -1)
+        {
+            dprintf(STDERR_FILENO, "shell: %s: %s\n", path.c_str(), strerror(errno));
+            return;
+        }
+
+        for (size_t written = 0; written < json.size();)
+        {
+            ssize_t size = ::write(fd, json.data() + written, json.size() - written);
+            if (size == -1 && errno == EINTR)
+                continue;
+
+            if (size <= 0)
+                break;
+
+            written += size;
+        }
+
+        ::close(fd);
+    }
+
+    void start(void)
+    {
+        if (ring == nullptr)
+        {
+            ring = new Event[CAPACITY];
+            owner = getpid();
+
+            const char *value = std::getenv(TRACE_ENVVAR);
+            if (value != nullptr && *value != '\0' && std::strcmp(value, "1") != 0)
+                path = value;
+            else
+                path = "shell-trace." + std::to_string(owner) + ".json";
+
+            std::atexit(flush);
+        }
+
+        active.store(true, std::memory_order_relaxed);
+    }
+
+    void stop(void)
+    {
+        active.store(false, std::memory_order_relaxed);
+    }
+
+    void initialize(void)
+    {
+        if (std::getenv(TRACE_ENVVAR) != nullptr)
+            start();
+    }
+}
@@ -0,0 +1,753 @@
+#include "shell.hpp"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+#define TRANSFER_CHUNK (1 << 24)
+#define READ_WRITE_BUFFER_SIZE (64 * 1024)
+
+namespace utilities
+{
+    enum class Method
+    {
+        COPY_FILE_RANGE,
+        SENDFILE,
+        SPLICE,
+        READ_WRITE,
+    };
+
+    // the escapes of a printf format, and of %b arguments where \c also ends all output
+    static size_t escape(const std::string &text, size_t index, std::string &output, bool in_argument, bool &stop)
+    {
+        char character = text[index];
+
+        if (character >= '0' && character <= '7')
+        {
+            // %b takes \0ddd, the format itself \ddd
+            size_t start = in_argument && character == '0' ? index + 1 : index;
+            size_t end = start;
+
+            int value = 0;
+            while (end < text.size() && end < start + 3 && text[end] >= '0' && text[end] <= '7')
+                value = value * 8 + (text[end++] - '0');
+
+            output.push_back((char)value);
+            return (std::max(end, index + 1));
+        }
+
+        switch (character)
+        {
+        case '\\':
+            output.push_back('\\');
+            break;
+        case 'a':
+            output.push_back('\a');
+            break;
+        case 'b':
+            output.push_back('\b');
+            break;
+        case 'f':
+            output.push_back('\f');
+            break;
+        case 'n':
+            output.push_back('\n');
+            break;
+        case 'r':
+            output.push_back('\r');
+            break;
+        case 't':
+            output.push_back('\t');
+            break;
+        case 'v':
+            output.push_back('\v');
+            break;
+        case 'c':
+            if (in_argument)
+            {
+                stop = true;
+                break;
+            }
+            [[fallthrough]];
+        default:
+            output.push_back('\\');
+            output.push_back(character);
+            break;
+        }
+
+        return (index + 1);
+    }
+
+    // a leading quote stands for the code of the character after it, as POSIX asks
+    static bool numeric_prefix(const std::string &argument, intmax_t &value)
+    {
+        if (!argument.empty() && (argument[0] == '\'' || argument[0] == '"'))
+        {
+            value = argument.size() > 1 ? (unsigned char)argument[1] : 0;
+            return (true);
+        }
+
+        return (false);
+    }
+
+    static intmax_t to_integer(const std::string &argument, int error, int &status)
+    {
+        intmax_t value = 0;
+        if (argument.empty() || numeric_prefix(argument, value))
+            return (value);
+
+        char *end = nullptr;
+        errno = 0;
+        value = std::strtoimax(argument.c_str(), &end, 0);
+
+        if (*end != '\0' || errno == ERANGE)
+        {
+            dprintf(error, "printf: %s: %s\n", argument.c_str(), errno == ERANGE ? strerror(ERANGE) : "invalid number");
+            status = 1;
+        }
+
+        return (value);
+    }
+
+    static double to_floating(const std::string &argument, int error, int &status)
+    {
+        intmax_t code = 0;
+        if (argument.empty())
+            return (0);
+
+        if (numeric_prefix(argument, code))
+            return ((double)code);
+
+        char *end = nullptr;
+        double value = std::strtod(argument.c_str(), &end);
+
+        if (*end != '\0')
+        {
+            dprintf(error, "printf: %s: invalid number\n", argument.c_str());
+            status = 1;
+        }
+
+        return (value);
+    }
+
+    // one pass over the format, returns false once \c asked for the output to end
+    static bool format_once(const std::string &format, const std::vector<std::string> &arguments, size_t &next, BufferedWriter &output, int error, int &status)
+    {
+        static const std::string empty;
+
+        auto argument = [&]() -> const std::string &
+        {
+            return (next < arguments.size() ? arguments[next++] : empty);
+        };
+
+        std::string literal;
+
+        for (size_t index = 0; index < format.size();)
+        {
+            char character = format[index];
+
+            if (character == '\\' && index + 1 < format.size())
+            {
+                bool stop = false;
+                index = escape(format, index + 1, literal, false, stop);
+                continue;
+            }
+
+            if (character != '%' || index + 1 == format.size())
+            {
+                literal.push_back(character);
+                ++index;
+                continue;
+            }
+
+            if (format[index + 1] == '%')
+            {
+                literal.push_back('%');
+                index += 2;
+                continue;
+            }
+
+            output.write(literal);
+            literal.clear();
+
+            size_t start = index++;
+
+            std::string specification = "%";
+            while (index < format.size() && std::strchr("-+ #0", format[index]) != nullptr)
+                specification.push_back(format[index++]);
+
+            if (index < format.size() && format[index] == '*')
+            {
+                specification += std::to_string(to_integer(argument(), error, status));
+                ++index;
+            }
+            else
+            {
+                while (index < format.size() && std::isdigit(format[index]))
+                    specification.push_back(format[index++]);
+            }
+
+            if (index < format.size() && format[index] == '.')
+            {
+                specification.push_back(format[index++]);
+
+                if (index < format.size() && format[index] == '*')
+                {
+                    specification += std::to_string(to_integer(argument(), error, status));
+                    ++index;
+                }
+                else
+                {
+                    while (index < format.size() && std::isdigit(format[index]))
+                        specification.push_back(format[index++]);
+                }
+            }
+
+            char conversion = index < format.size() ? format[index++] : '\0';
+            switch (conversion)
+            {
+            case 'd':
+            case 'i':
+                output.printf((specification + "j" + conversion).c_str(), to_integer(argument(), error, status));
+                break;
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X':
+                output.printf((specification + "j" + conversion).c_str(), (uintmax_t)to_integer(argument(), error, status));
+                break;
+            case 'f':
+            case 'F':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+                output.printf((specification + conversion).c_str(), to_floating(argument(), error, status));
+                break;
+            case 'c':
+                output.printf((specification + "s").c_str(), argument().substr(0, 1).c_str());
+                break;
+            case 's':
+                output.printf((specification + "s").c_str(), argument().c_str());
+                break;
+            case 'b':
+            {
+                const std::string &text = argument();
+
+                std::string expanded;
+                bool stop = false;
+                for (size_t position = 0; position < text.size() && !stop;)
+                {
+                    if (text[position] == '\\' && position + 1 < text.size())
+                        position = escape(text, position + 1, expanded, true, stop);
+                    else
+                        expanded.push_back(text[position++]);
+                }
+
+                output.printf((specification + "s").c_str(), expanded.c_str());
+
+                if (stop)
+                    return (false);
+
+                break;
+            }
+            default:
+                dprintf(error, "printf: %s: invalid directive\n", format.substr(start, index - start).c_str());
+                status = 1;
+                return (false);
+            }
+        }
+
+        output.write(literal);
+        return (true);
+    }
+
+    int printf(const std::vector<std::string> &arguments, const RedirectedStreams &streams)
+    {
+        size_t next = arguments.size() > 1 && arguments[1] == "--" ? 2 : 1;
+        if (next >= arguments.size())
+        {
+            dprintf(streams.error(), "printf: usage: printf format [arguments]\n");
+            return (2);
+        }
+
+        const std::string &format = arguments[next++];
+
+        BufferedWriter output(streams.output());
+        int status = 0;
+
+        // the format is reused while arguments are left, as long as it consumes any
+        size_t consumed;
+        do
+        {
+            consumed = next;
+
+            if (!format_once(format, arguments, next, output, streams.error(), status))
+                break;
+        } while (next < arguments.size() && next != consumed);
+
+        return (status);
+    }
+
+    typedef struct
+    {
+        std::span<const std::string> words;
+        size_t position;
+        bool failed;
+        const char *name;
+        int error;
+    } Expression;
+
+    static bool is_unary(const std::string &word)
+    {
+        return (word.size() == 2 && word[0] == '-' && std::strchr("bcdefghknprstuwxzGLOS", word[1]) != nullptr);
+    }
+
+    static bool is_binary(const std::string &word)
+    {
+        static const char *const OPERATORS[] = {"=", "==", "!=", "<", ">", "-eq", "-ne", "-gt", "-ge", "-lt", "-le", "-nt", "-ot", "-ef"};
+
+        return (std::any_of(std::begin(OPERATORS), std::end(OPERATORS), [&word](const char *name)
+                            { return (word == name); }));
+    }
+
+    static bool fail(Expression &expression, const std::string &message)
+    {
+        if (!expression.failed)
+            dprintf(expression.error, "%s: %s\n", expression.name, message.c_str());
+
+        expression.failed = true;
+        return (false);
+    }
+
+    static bool unary(Expression &expression, const std::string &option, const std::string &operand)
+    {
+        char test = option[1];
+
+        if (test == 'n')
+            return (!operand.empty());
+
+        if (test == 'z')
+            return (operand.empty());
+
+        if (test == 't')
+            return (!operand.empty() && std::all_of(operand.begin(), operand.end(), ::isdigit) && isatty((int)std::strtol(operand.c_str(), nullptr, 10)));
+
+        struct stat status;
+        bool link = test == 'h' || test == 'L';
+        if ((link ? lstat(operand.c_str(), &status) : stat(operand.c_str(), &status)) == -1)
+            return (false);
+
+        switch (test)
+        {
+        case 'b':
+            return (S_ISBLK(status.st_mode));
+        case 'c':
+            return (S_ISCHR(status.st_mode));
+        case 'd':
+            return (S_ISDIR(status.st_mode));
+        case 'e':
+            return (true);
+        case 'f':
+            return (S_ISREG(status.st_mode));
+        case 'g':
+            return ((status.st_mode & S_ISGID) != 0);
+        case 'h':
+        case 'L':
+            return (S_ISLNK(status.st_mode));
+        case 'k':
+            return ((status.st_mode & S_ISVTX) != 0);
+        case 'p':
+            return (S_ISFIFO(status.st_mode));
+        case 'r':
+            return (access(operand.c_str(), R_OK) == 0);
+        case 's':
+            return (status.st_size > 0);
+        case 'S':
+            return (S_ISSOCK(status.st_mode));
+        case 'u':
+            return ((status.st_mode & S_ISUID) != 0);
+        case 'w':
+            return (access(operand.c_str(), W_OK) == 0);
+        case 'x':
+            return (access(operand.c_str(), X_OK) == 0);
+        case 'O':
+            return (status.st_uid == geteuid());
+        case 'G':
+            return (status.st_gid == getegid());
+        default:
+            return (fail(expression, option + ": unary operator expected"));
+        }
+    }
+
+    static std::optional<intmax_t> to_test_integer(Expression &expression, const std::string &word)
+    {
+        char *end = nullptr;
+        errno = 0;
+        intmax_t value = std::strtoimax(word.c_str(), &end, 10);
+
+        if (word.empty() || *end != '\0' || errno == ERANGE)
+        {
+            fail(expression, word + ": integer expression expected");
+            return (std::nullopt);
+        }
+
+        return (value);
+    }
+
+    static bool binary(Expression &expression, const std::string &left, const std::string &operation, const std::string &right)
+    {
+        if (operation == "=" || operation == "==")
+            return (left == right);
+        if (operation == "!=")
+            return (left != right);
+        if (operation == "<")
+            return (left < right);
+        if (operation == ">")
+            return (left > right);
+
+        if (operation == "-nt" || operation == "-ot" || operation == "-ef")
+        {
+            struct stat x, y;
+            bool has_x = stat(left.c_str(), &x) == 0;
+            bool has_y = stat(right.c_str(), &y) == 0;
+
+            if (operation == "-ef")
+                return (has_x && has_y && x.st_dev == y.st_dev && x.st_ino == y.st_ino);
+
+            auto newer = [](const struct stat &a, const struct stat &b)
+            {
+                return (a.st_mtim.tv_sec != b.st_mtim.tv_sec ? a.st_mtim.tv_sec > b.st_mtim.tv_sec : a.st_mtim.tv_nsec > b.st_mtim.tv_nsec);
+            };
+
+            if (operation == "-nt")
+                return (has_x && (!has_y || newer(x, y)));
+
+            return (has_y && (!has_x || newer(y, x)));
+        }
+
+        std::optional<intmax_t> x = to_test_integer(expression, left);
+        std::optional<intmax_t> y = to_test_integer(expression, right);
+        if (!x.has_value() || !y.has_value())
+            return (false);
+
+        if (operation == "-eq")
+            return (x == y);
+        if (operation == "-ne")
+            return (x != y);
+        if (operation == "-gt")
+            return (x > y);
+        if (operation == "-ge")
+            return (x >= y);
+        if (operation == "-lt")
+            return (x < y);
+
+        return (x <= y);
+    }
+
+    static bool disjunction(Expression &expression);
+
+    static bool primary(Expression &expression)
+    {
+        std::span<const std::string> words = expression.words;
+        size_t left = words.size() - expression.position;
+
+        if (left == 0)
+            return (fail(expression, "argument expected"));
+
+        const std::string &word = words[expression.position];
+
+        if (word == "(" && left > 1)
+        {
+            ++expression.position;
+            bool value = disjunction(expression);
+
+            if (expression.position >= words.size() || words[expression.position] != ")")
+                return (fail(expression, "`)' expected"));
+
+            ++expression.position;
+            return (value);
+        }
+
+        if (left >= 3 && is_binary(words[expression.position + 1]))
+        {
+            expression.position += 3;
+            return (binary(expression, word, words[expression.position - 2], words[expression.position - 1]));
+        }
+
+        if (left >= 2 && is_unary(word))
+        {
+            expression.position += 2;
+            return (unary(expression, word, words[expression.position - 1]));
+        }
+
+        ++expression.position;
+        return (!word.empty());
+    }
+
+    static bool negation(Expression &expression)
+    {
+        if (expression.position < expression.words.size() && expression.words[expression.position] == "!")
+        {
+            ++expression.position;
+            return (!negation(expression));
+        }
+
+        return (primary(expression));
+    }
+
+    static bool conjunction(Expression &expression)
+    {
+        bool value = negation(expression);
+
+        while (expression.position < expression.words.size() && expression.words[expression.position] == "-a")
+        {
+            ++expression.position;
+            value = negation(expression) && value;
+        }
+
+        return (value);
+    }
+
+    static bool disjunction(Expression &expression)
+    {
+        bool value = conjunction(expression);
+
+        while (expression.position < expression.words.size() && expression.words[expression.position] == "-o")
+        {
+            ++expression.position;
+            value = conjunction(expression) || value;
+        }
+
+        return (value);
+    }
+
+    // up to four arguments are decided by their count as POSIX lays out, longer ones by the -a and -o grammar
+    static bool evaluate(Expression &expression, std::span<const std::string> words)
+    {
+        switch (words.size())
+        {
+        case 0:
+            return (false);
+        case 1:
+            return (!words[0].empty());
+        case 2:
+            if (words[0] == "!")
+                return (words[1].empty());
+            if (is_unary(words[0]))
+                return (unary(expression, words[0], words[1]));
+            return (fail(expression, words[0] + ": unary operator expected"));
+        case 3:
+            if (is_binary(words[1]))
+                return (binary(expression, words[0], words[1], words[2]));
+            if (words[0] == "!")
+                return (!evaluate(expression, words.subspan(1)));
+            if (words[0] == "(" && words[2] == ")")
+                return (!words[1].empty());
+            break;
+        case 4:
+            if (words[0] == "!")
+                return (!evaluate(expression, words.subspan(1)));
+            if (words[0] == "(" && words[3] == ")")
+                return (evaluate(expression, words.subspan(1, 2)));
+            break;
+        }
+
+        expression.words = words;
+        expression.position = 0;
+
+        bool value = disjunction(expression);
+        if (expression.position != words.size())
+            return (fail(expression, words[expression.position] + ": too many arguments"));
+
+        return (value);
+    }
+
+    int test(const std::vector<std::string> &arguments, const RedirectedStreams &streams)
+    {
+        std::span<const std::string> words(arguments.begin() + 1, arguments.end());
+
+        if (arguments[0] == "[")
+        {
+            if (words.empty() || words.back() != "]")
+            {
+                dprintf(streams.error(), "[: missing `]'\n");
+                return (2);
+            }
+
+            words = words.first(words.size() - 1);
+        }
+
+        Expression expression = {
+            .words = words,
+            .position = 0,
+            .failed = false,
+            .name = arguments[0].c_str(),
+            .error = streams.error()};
+
+        bool value = evaluate(expression, words);
+        if (expression.failed)
+            return (2);
+
+        return (value ? 0 : 1);
+    }
+
+    static Method fallback(Method method, const struct stat &input)
+    {
+        if (method == Method::COPY_FILE_RANGE || (method == Method::SPLICE && S_ISREG(input.st_mode)))
+            return (Method::SENDFILE);
+
+        return (Method::READ_WRITE);
+    }
+
+    static bool write_all(int fd, const char *data, size_t size)
+    {
+        for (size_t written = 0; written < size;)
+        {
+            ssize_t count = ::write(fd, data + written, size - written);
+            if (count == -1 && errno == EINTR)
+                continue;
+
+            if (count <= 0)
+                return (false);
+
+            written += count;
+        }
+
+        return (true);
+    }
+
+    // the bytes stay in the kernel where it allows, each refusal steps down to a plainer way of moving them
+    static bool transfer(int input, int output)
+    {
+        struct stat input_status, output_status;
+        if (fstat(input, &input_status) == -1 || fstat(output, &output_status) == -1)
+            return (false);
+
+        Method method = Method::READ_WRITE;
+        if (S_ISREG(input_status.st_mode) && S_ISREG(output_status.st_mode))
+            method = Method::COPY_FILE_RANGE;
+        else if (S_ISFIFO(input_status.st_mode) || S_ISFIFO(output_status.st_mode))
+            method = Method::SPLICE;
+        else if (S_ISREG(input_status.st_mode))
+            method = Method::SENDFILE;
+
+        char buffer[READ_WRITE_BUFFER_SIZE];
+
+        while (true)
+        {
+            ssize_t size;
+            switch (method)
+            {
+            case Method::COPY_FILE_RANGE:
+                size = copy_file_range(input, nullptr, output, nullptr, TRANSFER_CHUNK, 0);
+                break;
+            case Method::SENDFILE:
+                size = sendfile(output, input, nullptr, TRANSFER_CHUNK);
+                break;
+            case Method::SPLICE:
+                size = splice(input, nullptr, output, nullptr, TRANSFER_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+                break;
+            case Method::READ_WRITE:
+            default:
+                size = ::read(input, buffer, sizeof(buffer));
+                if (size > 0 && !write_all(output, buffer, size))
+                    return (false);
+                break;
+            }
+
+            if (size == 0)
+                return (true);
+
+            if (size != -1)
+                continue;
+
+            if (errno == EINTR)
+                continue;
+
+            if (method != Method::READ_WRITE && (errno == EINVAL || errno == ENOSYS || errno == EXDEV || errno == EOPNOTSUPP || errno == EBADF))
+            {
+                method = fallback(method, input_status);
+                continue;
+            }
+
+            return (false);
+        }
+    }
+
+    int cat(const std::vector<std::string> &arguments, const RedirectedStreams &streams)
+    {
+        size_t index = 1;
+        for (; index < arguments.size() && arguments[index].size() > 1 && arguments[index].starts_with('-'); ++index)
+        {
+            // output is never buffered anyway, so -u needs nothing
+            if (arguments[index] == "--")
+            {
+                ++index;
+                break;
+            }
+
+            if (arguments[index] != "-u")
+            {
+                dprintf(streams.error(), "cat: %s: invalid option\n", arguments[index].c_str());
+                return (2);
+            }
+        }
+
+        std::vector<std::string> files(arguments.begin() + index, arguments.end());
+        if (files.empty())
+            files.push_back("-");
+
+        struct stat output_status;
+        bool output_regular = fstat(streams.output(), &output_status) == 0 && S_ISREG(output_status.st_mode);
+
+        int status = 0;
+        for (const auto &file : files)
+        {
+            bool standard = file == "-";
+            std::optional<int> named = named_descriptor(file);
+
+            // /dev/stdin and the like are the stage's streams, not the shell's
+            std::string path = named.has_value() ? reopen_path(streams.descriptor(named.value())) : file;
+
+            int fd = standard ? streams.input() : open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd == -1)
+            {
+                dprintf(streams.error(), "cat: %s: %s\n", file.c_str(), strerror(errno));
+                status = 1;
+                continue;
+            }
+
+            struct stat input_status;
+            if (output_regular && fstat(fd, &input_status) == 0 && S_ISREG(input_status.st_mode) && input_status.st_dev == output_status.st_dev && input_status.st_ino == output_status.st_ino && input_status.st_size != 0)
+            {
+                dprintf(streams.error(), "cat: %s: input file is output file\n", file.c_str());
+                status = 1;
+            }
+            else if (!transfer(fd, streams.output()))
+            {
+                // a reader that went away ends the whole output, like SIGPIPE would
+                if (errno == EPIPE)
+                {
+                    if (!standard)
+                        close(fd);
+
+                    return (1);
+                }
+
+                dprintf(streams.error(), "cat: %s: %s\n", file.c_str(), strerror(errno));
+                status = 1;
+            }
+
+            if (!standard)
+                close(fd);
+        }
+
+        return (status);
+    }
+}
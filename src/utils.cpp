@@ -1,21 +1,89 @@
 #include "shell.hpp"
 
-std::vector<std::string> split(std::string haystack, const std::string &needle)
+#include <algorithm>
+#include <climits>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+
+std::vector<std::string> split(const std::string &haystack, const std::string &needle)
 {
     std::vector<std::string> result;
 
-    while (!haystack.empty())
+    size_t start = 0;
+    while (start < haystack.size())
     {
-        size_t index = haystack.find(needle);
-
-        std::string argument = haystack.substr(0, index);
-        result.push_back(argument);
+        size_t index = haystack.find(needle, start);
+        if (index == std::string::npos)
+            index = haystack.size();
 
-        if (index != std::string::npos)
-            index += needle.size();
+        result.emplace_back(haystack, start, index - start);
 
-        haystack.erase(0, index);
+        start = index + needle.size();
     }
 
     return result;
 }
+
+// a plain run of decimal digits, anything else or a value that does not fit gives nothing
+std::optional<unsigned long long> parse_unsigned(const std::string &text)
+{
+    if (text.empty() || !std::all_of(text.begin(), text.end(), ::isdigit))
+        return (std::nullopt);
+
+    errno = 0;
+    unsigned long long value = std::strtoull(text.c_str(), nullptr, 10);
+    if (errno == ERANGE)
+        return (std::nullopt);
+
+    return (value);
+}
+
+// /dev/stdin, /dev/stdout, /dev/stderr and /dev/fd/N name a descriptor of whoever opens them, gives which one
+std::optional<int> named_descriptor(const std::string &path)
+{
+    if (path == "/dev/stdin")
+        return (STDIN_FILENO);
+
+    if (path == "/dev/stdout")
+        return (STDOUT_FILENO);
+
+    if (path == "/dev/stderr")
+        return (STDERR_FILENO);
+
+    for (std::string_view prefix : {"/dev/fd/", "/proc/self/fd/"})
+    {
+        if (!path.starts_with(prefix))
+            continue;
+
+        std::optional<unsigned long long> fd = parse_unsigned(path.substr(prefix.size()));
+        if (fd.has_value() && fd.value() <= INT_MAX)
+            return ((int)fd.value());
+    }
+
+    return (std::nullopt);
+}
+
+// a command opening one of those gets what its own descriptor refers to, which for a stage run by the shell
+// is not the shell's, so the stage's descriptor is reopened through /proc with the flags asked for
+std::string reopen_path(int fd)
+{
+    return ("/proc/self/fd/" + std::to_string(fd));
+}
+
+void append_json_escaped(std::string &json, std::string_view string)
+{
+    for (unsigned char character : string)
+    {
+        if (character == '"' || character == '\\')
+            json.append(1, '\\').append(1, character);
+        else if (character < 0x20)
+        {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", character);
+            json += escaped;
+        }
+        else
+            json += character;
+    }
+}
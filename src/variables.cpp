@@ -0,0 +1,102 @@
+#include "shell.hpp"
+
+#include <cstdlib>
+#include <cctype>
+
+#define PIPESTATUS_NAME "PIPESTATUS"
+
+namespace variables
+{
+    static int last_status = 0;
+    static std::vector<int> last_pipestatus = {0};
+    static pid_t last_background = 0;
+
+    void set_status(int code)
+    {
+        last_status = code;
+        last_pipestatus.assign(1, code);
+    }
+
+    void set_pipestatus(const std::vector<int> &codes)
+    {
+        if (codes.empty())
+            return;
+
+        last_status = codes.back();
+        last_pipestatus = codes;
+    }
+
+    void set_last_background(pid_t pid)
+    {
+        last_background = pid;
+    }
+
+    int status(void)
+    {
+        return (last_status);
+    }
+
+    const std::vector<int> &pipestatus(void)
+    {
+        return (last_pipestatus);
+    }
+
+    static std::string join(const std::vector<int> &codes)
+    {
+        std::string joined;
+
+        for (size_t index = 0; index < codes.size(); ++index)
+        {
+            if (index != 0)
+                joined += ' ';
+
+            joined += std::to_string(codes[index]);
+        }
+
+        return (joined);
+    }
+
+    static std::optional<std::string> get_pipestatus(const std::string &subscript)
+    {
+        if (subscript == "@" || subscript == "*")
+            return (join(last_pipestatus));
+
+        size_t index = 0;
+        for (char character : subscript)
+        {
+            if (!std::isdigit(character))
+                return (std::nullopt);
+
+            index = index * 10 + (character - '0');
+        }
+
+        if (subscript.empty() || index >= last_pipestatus.size())
+            return (std::nullopt);
+
+        return (std::to_string(last_pipestatus[index]));
+    }
+
+    std::optional<std::string> get(const std::string &name)
+    {
+        if (name == "?")
+            return (std::to_string(last_status));
+
+        if (name == "!")
+            return (last_background != 0 ? std::optional(std::to_string(last_background)) : std::nullopt);
+
+        if (name == PIPESTATUS_NAME)
+            return (get_pipestatus("0"));
+
+        if (name.starts_with(PIPESTATUS_NAME "[") && name.ends_with(']'))
+        {
+            size_t offset = sizeof(PIPESTATUS_NAME);
+            return (get_pipestatus(name.substr(offset, name.length() - offset - 1)));
+        }
+
+        const char *value = getenv(name.c_str());
+        if (value == nullptr)
+            return (std::nullopt);
+
+        return (std::string(value));
+    }
+}
@@ -0,0 +1,128 @@
+#include "shell.hpp"
+
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <sys/uio.h>
+
+// writes every vector completely, a reader that went away drops the rest
+static bool write_vectors(int fd, iovec *vectors, int count)
+{
+    while (count != 0)
+    {
+        ssize_t written = writev(fd, vectors, count);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            return (false);
+        }
+
+        while (count != 0 && (size_t)written >= vectors->iov_len)
+        {
+            written -= vectors->iov_len;
+            ++vectors;
+            --count;
+        }
+
+        if (count != 0)
+        {
+            vectors->iov_base = (char *)vectors->iov_base + written;
+            vectors->iov_len -= written;
+        }
+    }
+
+    return (true);
+}
+
+BufferedWriter::BufferedWriter(int fd)
+    : _fd(fd),
+      _size(0)
+{
+}
+
+BufferedWriter::~BufferedWriter()
+{
+    flush();
+}
+
+bool BufferedWriter::flush()
+{
+    if (_size == 0)
+        return (true);
+
+    iovec vector = {.iov_base = _buffer, .iov_len = _size};
+    _size = 0;
+
+    return (write_vectors(_fd, &vector, 1));
+}
+
+void BufferedWriter::write(std::string_view data)
+{
+    if (data.size() <= CAPACITY - _size)
+    {
+        std::memcpy(_buffer + _size, data.data(), data.size());
+        _size += data.size();
+        return;
+    }
+
+    // what does not fit goes out together with the pending bytes, without being copied first
+    iovec vectors[2] = {
+        {.iov_base = _buffer, .iov_len = _size},
+        {.iov_base = const_cast<char *>(data.data()), .iov_len = data.size()},
+    };
+
+    _size = 0;
+    write_vectors(_fd, vectors, 2);
+}
+
+void BufferedWriter::number(size_t value, int width)
+{
+    char digits[24];
+    char *end = digits + sizeof(digits);
+    char *start = end;
+
+    do
+    {
+        *--start = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+
+    size_t length = end - start;
+    size_t padding = width > (int)length ? width - length : 0;
+
+    if (padding + length > CAPACITY - _size)
+        flush();
+
+    std::memset(_buffer + _size, ' ', padding);
+    std::memcpy(_buffer + _size + padding, start, length);
+    _size += padding + length;
+}
+
+void BufferedWriter::printf(const char *format, ...)
+{
+    va_list arguments;
+
+    va_start(arguments, format);
+    int length = vsnprintf(_buffer + _size, CAPACITY - _size, format, arguments);
+    va_end(arguments);
+
+    if (length < 0)
+        return;
+
+    if ((size_t)length < CAPACITY - _size)
+    {
+        _size += length;
+        return;
+    }
+
+    std::string formatted(length, '\0');
+
+    va_start(arguments, format);
+    vsnprintf(formatted.data(), length + 1, format, arguments);
+    va_end(arguments);
+
+    write(formatted);
+}